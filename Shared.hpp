@@ -1,9 +1,15 @@
 #pragma once
 #include "VapourSynth.h"
 #include "VSHelper.h"
+#include "Transfer.hpp"
+#include "Statistics.hpp"
 #include <cmath>
 #include <cstring>
 #include <algorithm>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <shared_mutex>
 #include <immintrin.h>
 
 #if defined(_MSC_VER)
@@ -14,26 +20,268 @@
 #include "cpufeatures_gnu.hpp"
 #endif
 
+struct PlanePlan final {
+	int width = 0;
+	int height = 0;
+	int WidthMod8 = 0;
+	int64_t FieldPixelCount = 0;
+	int64_t transfer = TransferLinear;
+	double BaseColor = 0.;
+	bool NonTemporal = false;
+	// integer load x * InputScale + InputOffset, integer store x * OutputScale + OutputOffset + dither
+	float InputScale = 1.f;
+	float InputOffset = 0.f;
+	float OutputScale = 1.f;
+	float OutputOffset = 0.f;
+	float OutputMaximum = 0.f;
+	float DitherRows[8][8] = {};
+	bool ConvertSamples = false;
+};
+
+// ordered dither of integer output
+constexpr int BayerMatrix[8][8] = {
+	{ 0, 32, 8, 40, 2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44, 4, 36, 14, 46, 6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{ 3, 35, 11, 43, 1, 33, 9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47, 7, 39, 13, 45, 5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// the AVX kernels evaluate the same operations
+template<typename SampleType>
+static inline auto LoadSample(const PlanePlan &p, SampleType x) {
+	return static_cast<float>(x) * p.InputScale + p.InputOffset;
+}
+
+static inline auto LoadSample(const PlanePlan &, float x) {
+	return x;
+}
+
+// clamped like maxps and minps, NaN goes to 0
+template<typename SampleType>
+static inline auto StoreSample(const PlanePlan &p, float x, int X, int Y, SampleType &Sample) {
+	auto Value = x * p.OutputScale + p.OutputOffset + p.DitherRows[Y % 8][X % 8];
+	Value = Value > 0.f ? Value : 0.f;
+	Value = Value < p.OutputMaximum ? Value : p.OutputMaximum;
+	Sample = static_cast<SampleType>(nearbyintf(Value));
+}
+
+static inline auto StoreSample(const PlanePlan &, float x, int, int, float &Sample) {
+	Sample = x;
+}
+
+// 8 bit, 9 - 16 bit integer or float
+static inline auto GetSampleIndex(const VSFormat *fi) {
+	return fi->sampleType == stFloat ? 2 : fi->bytesPerSample == 1 ? 0 : 1;
+}
+
+// lane i sums the samples at x % 8 == i, every kernel reduces in this order
+struct alignas(32) ReductionLanes final {
+	double lanes[8] = {};
+};
+
+static inline auto Reduce(const ReductionLanes &Field) {
+	auto &&lanes = Field.lanes;
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+static inline auto GetFieldSum(const PlanePlan &p, const ReductionLanes &Field, int64_t LineCount) {
+	return Reduce(Field) - p.BaseColor * LineCount * p.width;
+}
+
+struct FieldGains final {
+	double gains[2] = { 1., 1. };
+	bool copy[2] = { true, true };
+};
+
+struct FieldMoments final {
+	double TopFieldSum = 0.;
+	double BottomFieldSum = 0.;
+	double TopSquareSum = 0.;
+	double BottomSquareSum = 0.;
+	double CrossSum = 0.;
+};
+
+// y picks the dither row
+struct FixFadesKernels final {
+	auto (*SumField)(const PlanePlan &, const void *const *, int, double &)->void;
+	auto (*Moments)(const PlanePlan &, const void *const *, FieldMoments &)->void;
+	auto (*ConvertLine)(const PlanePlan &, const void *, void *, int)->void;
+	auto (*ProcessLine)(const PlanePlan &, const void *, void *, int, double)->void;
+	auto (*CopySumLine)(const PlanePlan &, const void *, void *, int, ReductionLanes &)->void;
+	auto (*ProcessSumLine)(const PlanePlan &, const void *, void *, int, double, ReductionLanes &)->void;
+	auto (*ProcessReferenceLine)(const PlanePlan &, const void *, const void *, void *, int, double)->void;
+};
+
+static inline auto ApplyGain(const PlanePlan &p, float x, float Gain, float BaseColor) {
+	return FromLinear((ToLinear(x, p.transfer) - BaseColor) * Gain + BaseColor, p.transfer);
+}
+
+static inline auto ApplyGain(const PlanePlan &p, float x, float Gain) {
+	return ApplyGain(p, x, Gain, static_cast<float>(p.BaseColor));
+}
+
+// [input][output] as given by GetSampleIndex
+extern const FixFadesKernels KernelsCPP[3][3];
+extern const FixFadesKernels KernelsAVXFMA[3][3];
+
+struct ProcessingPlan final {
+	const char *error = nullptr;
+	const FixFadesKernels *kernels = nullptr;
+	const VSFormat *OutputFormat = nullptr;
+	int numPlanes = 0;
+	PlanePlan planes[3];
+};
+
+// carried between the 2 activations of a frame in reference mode
+struct ReferenceStage final {
+	double thresholds[3] = {};
+	double sums[3][2] = {};
+	bool corrected[3] = {};
+	bool ReferenceRequested = false;
+	int64_t BytesRead = 0;
+};
+
+// per plane values keyed by frame, field pair or source field
+template<typename Value>
+struct KeyedPlaneCache final {
+	static constexpr auto Size = 256;
+	struct Entry final {
+		int64_t key = -1;
+		const ProcessingPlan *plan = nullptr;
+		int plane = -1;
+		Value value = {};
+	};
+	Entry entries[Size];
+	std::mutex lock;
+	auto Store(int64_t key, const ProcessingPlan *plan, int plane, const Value &value) {
+		std::lock_guard<std::mutex> guard{ lock };
+		auto &&entry = entries[(key * 3 + plane) % Size];
+		entry.key = key;
+		entry.plan = plan;
+		entry.plane = plane;
+		entry.value = value;
+	}
+	auto Fetch(int64_t key, const ProcessingPlan *plan, int plane, Value &value) {
+		std::lock_guard<std::mutex> guard{ lock };
+		auto &&entry = entries[(key * 3 + plane) % Size];
+		if (entry.key != key || entry.plan != plan || entry.plane != plane)
+			return false;
+		value = entry.value;
+		return true;
+	}
+	// replaces value with the one already stored under the key, stores it if there is none
+	auto Share(int64_t key, const ProcessingPlan *plan, int plane, Value &value) {
+		std::lock_guard<std::mutex> guard{ lock };
+		auto &&entry = entries[(key * 3 + plane) % Size];
+		if (entry.key == key && entry.plan == plan && entry.plane == plane)
+			value = entry.value;
+		else {
+			entry.key = key;
+			entry.plan = plan;
+			entry.plane = plane;
+			entry.value = value;
+		}
+	}
+};
+
+// 2 * film frame + parity, top field first AA BB BC CD DD takes top fields from film frames 0 1 1 2 3 and bottom fields from 0 1 2 3 3
+static inline auto GetFieldIdentity(int64_t n, int64_t cadence, bool TopFieldFirst, int parity) {
+	constexpr int64_t Repeated[] = { 0, 1, 1, 2, 3 };
+	constexpr int64_t Advanced[] = { 0, 1, 2, 3, 3 };
+	auto position = (n + cadence) % 5;
+	auto FilmFrame = (n + cadence) / 5 * 4 + ((parity == 0) == TopFieldFirst ? Repeated[position] : Advanced[position]);
+	return FilmFrame * 2 + parity;
+}
+
+// n - 1 if the field repeats that of frame n - 1, else n
+static inline auto GetFieldOwner(int64_t n, int64_t cadence, bool TopFieldFirst, int parity) {
+	return n > 0 && GetFieldIdentity(n - 1, cadence, TopFieldFirst, parity) == GetFieldIdentity(n, cadence, TopFieldFirst, parity) ? n - 1 : n;
+}
+
 struct FixFadesData final {
+	// bytes per plane above which stores are non-temporal
+	static constexpr auto NonTemporalThreshold = 4ll << 20;
 	const VSAPI *vsapi = nullptr;
+	VSCore *core = nullptr;
 	VSNodeRef *node = nullptr;
+	VSNodeRef *reference = nullptr;
 	const VSVideoInfo *vi = nullptr;
+	VSVideoInfo OutputInfo = {};
+	const VSFormat *OutputFormat = nullptr;
+	bool dither = true;
 	bool illformed = false;
 	int64_t mode = 0;
+	int64_t estimator = 0;
 	double threshold = 0.;
+	double adaptive = 0.;
+	double MinimumThreshold = 0.;
+	bool SeededNoiseFloor = false;
+	int ColorChannelCount = -1;
 	double color[3] = { 0., 0., 0. };
+	int64_t transfer = TransferLinear;
+	int64_t chroma = 0;
+	bool fields = false;
+	int64_t tff = -1;
+	// keyed by field pair
+	KeyedPlaneCache<FieldMoments> PairCache;
+	KeyedPlaneCache<FieldMoments> ReferencePairCache;
+	KeyedPlaneCache<double> PairThresholds;
 	bool optimization = false;
-	FixFadesData(const VSMap *in, VSMap *out, const VSAPI *api) {
+	bool predict = false;
+	double tolerance = 0.;
+	// keyed by frame, predictions come from the nearest of the previous PredictionWindow frames
+	static constexpr auto PredictionWindow = 8;
+	KeyedPlaneCache<FieldMoments> PredictionCache;
+	int64_t cadence = -1;
+	// keyed by source field identity
+	KeyedPlaneCache<double> CadenceCache;
+	bool CollectStatistics = false;
+	std::string StatisticsPath;
+	std::string ReportPath;
+	ClipStatistics statistics;
+	const FixFadesKernels (*kernels)[3] = KernelsCPP;
+	std::map<std::tuple<const VSFormat *, int, int, bool>, ProcessingPlan> plans;
+	std::shared_timed_mutex PlanLock;
+	static auto IsSupportedFormat(const VSFormat *fi) {
+		return (fi->sampleType == stInteger && fi->bitsPerSample >= 8 && fi->bitsPerSample <= 16) || (fi->sampleType == stFloat && fi->bitsPerSample == 32);
+	}
+	FixFadesData(const VSMap *in, VSMap *out, const VSAPI *api, VSCore *instance) {
 		vsapi = api;
+		core = instance;
 		auto err = 0;
-		auto InputColorChannelCount = vsapi->propNumElements(in, "color");
+		ColorChannelCount = vsapi->propNumElements(in, "color");
 		node = vsapi->propGetNode(in, "clip", 0, nullptr);
 		vi = vsapi->getVideoInfo(node);
-		if (!isConstantFormat(vi) || vi->format->sampleType != stFloat || vi->format->bitsPerSample < 32) {
-			vsapi->setError(out, "FixFades: input clip must be single precision fp, with constant dimensions.");
+		OutputInfo = *vi;
+		if (vi->format != nullptr && !IsSupportedFormat(vi->format)) {
+			vsapi->setError(out, "FixFades: input clip must be 8 - 16 bit integer or single precision fp.");
 			illformed = true;
 			return;
 		}
+		auto OutputFormatID = vsapi->propGetInt(in, "format", 0, &err);
+		if (!err) {
+			OutputFormat = vsapi->getFormatPreset(static_cast<int>(OutputFormatID), core);
+			if (OutputFormat == nullptr || !IsSupportedFormat(OutputFormat)) {
+				vsapi->setError(out, "FixFades: format must be an 8 - 16 bit integer or single precision fp format!");
+				illformed = true;
+				return;
+			}
+			if (vi->format != nullptr) {
+				if (OutputFormat->colorFamily != vi->format->colorFamily || OutputFormat->subSamplingW != vi->format->subSamplingW || OutputFormat->subSamplingH != vi->format->subSamplingH) {
+					vsapi->setError(out, "FixFades: format may only change the sample type and bit depth of the clip!");
+					illformed = true;
+					return;
+				}
+				OutputInfo.format = OutputFormat;
+			}
+		}
+		dither = !!vsapi->propGetInt(in, "dither", 0, &err);
+		if (err)
+			dither = true;
 		mode = vsapi->propGetInt(in, "mode", 0, &err);
 		if (err)
 			mode = 0;
@@ -42,26 +290,239 @@ struct FixFadesData final {
 			illformed = true;
 			return;
 		}
+		estimator = vsapi->propGetInt(in, "estimator", 0, &err);
+		if (err)
+			estimator = 0;
+		if (estimator < 0 || estimator > 1) {
+			vsapi->setError(out, "FixFades: estimator must be 0 or 1!");
+			illformed = true;
+			return;
+		}
 		threshold = vsapi->propGetFloat(in, "threshold", 0, &err);
 		if (err)
 			threshold = 0.002;
+		else
+			MinimumThreshold = threshold;
 		if (threshold < 0.) {
 			vsapi->setError(out, "FixFades: threshold must not be negative!");
 			illformed = true;
 			return;
 		}
-		if (InputColorChannelCount != -1) {
-			if (vi->format->numPlanes != InputColorChannelCount) {
+		adaptive = vsapi->propGetFloat(in, "adaptive", 0, &err);
+		if (err)
+			adaptive = 0.;
+		if (adaptive < 0.) {
+			vsapi->setError(out, "FixFades: adaptive must not be negative!");
+			illformed = true;
+			return;
+		}
+		if (ColorChannelCount != -1) {
+			if (ColorChannelCount > 3 || (vi->format != nullptr && vi->format->numPlanes != ColorChannelCount)) {
 				vsapi->setError(out, "FixFades: Invalid color value for the input colorspace!");
 				illformed = true;
 				return;
 			}
-			for (auto i = 0; i < vi->format->numPlanes; ++i)
+			for (auto i = 0; i < ColorChannelCount; ++i)
 				color[i] = vsapi->propGetFloat(in, "color", i, nullptr);
 		}
+		transfer = vsapi->propGetInt(in, "transfer", 0, &err);
+		if (err)
+			transfer = TransferLinear;
+		if (transfer != TransferBT1886 && transfer != TransferLinear && transfer != TransferSRGB && transfer != TransferPQ) {
+			vsapi->setError(out, "FixFades: transfer must be 1 (BT.1886), 8 (linear), 13 (sRGB), or 16 (PQ)!");
+			illformed = true;
+			return;
+		}
+		chroma = vsapi->propGetInt(in, "chroma", 0, &err);
+		if (err)
+			chroma = 0;
+		if (chroma < 0 || chroma > 2) {
+			vsapi->setError(out, "FixFades: chroma must be 0, 1, or 2!");
+			illformed = true;
+			return;
+		}
+		if (chroma != 0 && vi->format != nullptr && vi->format->colorFamily != cmYUV) {
+			vsapi->setError(out, "FixFades: chroma=1 and chroma=2 only work with YUV clips!");
+			illformed = true;
+			return;
+		}
+		if (chroma == 1 && transfer != TransferLinear) {
+			vsapi->setError(out, "FixFades: chroma=1 only works with transfer=8!");
+			illformed = true;
+			return;
+		}
+		fields = !!vsapi->propGetInt(in, "fields", 0, &err);
+		if (err)
+			fields = false;
+		tff = vsapi->propGetInt(in, "tff", 0, &err);
+		if (err)
+			tff = -1;
+		else
+			tff = !!tff;
+		predict = !!vsapi->propGetInt(in, "predict", 0, &err);
+		if (err)
+			predict = false;
+		if (predict && estimator != 0) {
+			vsapi->setError(out, "FixFades: predict only works with estimator=0!");
+			illformed = true;
+			return;
+		}
+		tolerance = vsapi->propGetFloat(in, "tolerance", 0, &err);
+		if (err)
+			tolerance = 0.001;
+		if (tolerance < 0.) {
+			vsapi->setError(out, "FixFades: tolerance must not be negative!");
+			illformed = true;
+			return;
+		}
+		cadence = vsapi->propGetInt(in, "cadence", 0, &err);
+		if (err)
+			cadence = -1;
+		if (cadence < -1 || cadence > 4) {
+			vsapi->setError(out, "FixFades: cadence must be between -1 and 4!");
+			illformed = true;
+			return;
+		}
+		if (cadence != -1 && (estimator != 0 || predict)) {
+			vsapi->setError(out, "FixFades: cadence only works with estimator=0 and predict=False!");
+			illformed = true;
+			return;
+		}
+		reference = vsapi->propGetNode(in, "reference", 0, &err);
+		if (err)
+			reference = nullptr;
+		else {
+			auto ReferenceInfo = vsapi->getVideoInfo(reference);
+			if (ReferenceInfo->numFrames < vi->numFrames || ReferenceInfo->format != vi->format || ReferenceInfo->width != vi->width || ReferenceInfo->height != vi->height) {
+				vsapi->setError(out, "FixFades: reference must have the same format and dimensions as clip, and at least as many frames!");
+				illformed = true;
+				return;
+			}
+			if (ColorChannelCount != -1 || estimator != 0 || predict) {
+				vsapi->setError(out, "FixFades: reference replaces color, and only works with estimator=0 and predict=False!");
+				illformed = true;
+				return;
+			}
+		}
+		auto StatisticsInputCount = vsapi->propNumElements(in, "statsin");
+		for (auto i = 0; i < StatisticsInputCount; ++i) {
+			auto path = std::string{ vsapi->propGetData(in, "statsin", i, nullptr) };
+			if (!statistics.Import(path)) {
+				vsapi->setError(out, ("FixFades: failed to import statistics from " + path + "!").c_str());
+				illformed = true;
+				return;
+			}
+		}
+		SeededNoiseFloor = StatisticsInputCount > 0;
+		auto StatisticsOutput = vsapi->propGetData(in, "statsout", 0, &err);
+		if (!err)
+			StatisticsPath = StatisticsOutput;
+		auto ReportOutput = vsapi->propGetData(in, "report", 0, &err);
+		if (!err)
+			ReportPath = ReportOutput;
+		CollectStatistics = !StatisticsPath.empty() || !ReportPath.empty() || adaptive > 0.;
 		optimization = !!vsapi->propGetInt(in, "opt", 0, &err);
 		if (err)
 			optimization = true;
+		auto CPU = CPUFeatures{};
+		if (optimization && CPU.avx && CPU.fma3)
+			kernels = KernelsAVXFMA;
+	}
+	auto FetchPrediction(int n, int step, const ProcessingPlan *plan, FieldMoments (&sums)[3]) {
+		for (auto i = 1; i <= PredictionWindow && n - i * step >= 0; ++i) {
+			auto found = true;
+			for (auto plane = 0; plane < plan->numPlanes && found; ++plane)
+				found = PredictionCache.Fetch(n - i * step, plan, plane, sums[plane]);
+			if (found)
+				return true;
+		}
+		return false;
+	}
+	// adaptive times the noise floor once it is estimated, never below an explicit threshold
+	auto GetThreshold(int plane) const {
+		auto NoiseFloor = 0.;
+		if (adaptive > 0. && statistics.EstimateNoiseFloor(plane, SeededNoiseFloor, NoiseFloor))
+			return std::max(MinimumThreshold, adaptive * NoiseFloor);
+		return threshold;
+	}
+	auto BuildPlan(const VSFormat *fi, int width, int height, bool FullRange) {
+		auto plan = ProcessingPlan{};
+		if (!IsSupportedFormat(fi)) {
+			plan.error = "FixFades: input clip must be 8 - 16 bit integer or single precision fp.";
+			return plan;
+		}
+		if (ColorChannelCount != -1 && fi->numPlanes != ColorChannelCount) {
+			plan.error = "FixFades: Invalid color value for the input colorspace!";
+			return plan;
+		}
+		if (chroma != 0 && fi->colorFamily != cmYUV) {
+			plan.error = "FixFades: chroma=1 and chroma=2 only work with YUV clips!";
+			return plan;
+		}
+		if (chroma == 1 && transfer != TransferLinear) {
+			plan.error = "FixFades: chroma=1 only works with transfer=8!";
+			return plan;
+		}
+		constexpr auto BitMask = ~7;
+		plan.OutputFormat = OutputFormat == nullptr ? fi : vsapi->registerFormat(fi->colorFamily, OutputFormat->sampleType, OutputFormat->bitsPerSample, fi->subSamplingW, fi->subSamplingH, core);
+		auto &&fo = plan.OutputFormat;
+		plan.numPlanes = fi->numPlanes;
+		plan.kernels = &kernels[GetSampleIndex(fi)][GetSampleIndex(fo)];
+		// chroma centered on 0 like in float clips
+		auto GetScaleAndOffset = [&](const VSFormat *format, int plane, double &Scale, double &Offset) {
+			auto Chroma = format->colorFamily == cmYUV && plane > 0;
+			auto Shift = format->bitsPerSample - 8;
+			auto Range = FullRange ? (1 << format->bitsPerSample) - 1. : static_cast<double>((Chroma ? 224 : 219) << Shift);
+			auto Zero = Chroma ? static_cast<double>(1 << (format->bitsPerSample - 1)) : FullRange ? 0. : static_cast<double>(16 << Shift);
+			Scale = 1. / Range;
+			Offset = -Zero / Range;
+		};
+		for (auto i = 0; i < fi->numPlanes; ++i) {
+			auto &&p = plan.planes[i];
+			p.width = i == 0 ? width : width >> fi->subSamplingW;
+			p.height = i == 0 ? height : height >> fi->subSamplingH;
+			p.WidthMod8 = p.width & BitMask;
+			p.FieldPixelCount = static_cast<int64_t>(p.width) * p.height / 2;
+			// only RGB planes and luma are linearized
+			p.transfer = fi->colorFamily == cmRGB || i == 0 ? transfer : TransferLinear;
+			p.BaseColor = p.transfer == TransferLinear ? color[i] : static_cast<double>(ToLinear(static_cast<float>(color[i]), p.transfer));
+			p.NonTemporal = p.FieldPixelCount * 2 * fo->bytesPerSample > NonTemporalThreshold;
+			p.ConvertSamples = fo != fi;
+			if (fi->sampleType == stInteger) {
+				auto Scale = 0., Offset = 0.;
+				GetScaleAndOffset(fi, i, Scale, Offset);
+				p.InputScale = static_cast<float>(Scale);
+				p.InputOffset = static_cast<float>(Offset);
+			}
+			if (fo->sampleType == stInteger) {
+				auto Scale = 0., Offset = 0.;
+				GetScaleAndOffset(fo, i, Scale, Offset);
+				p.OutputScale = static_cast<float>(1. / Scale);
+				p.OutputOffset = static_cast<float>(-Offset / Scale);
+				p.OutputMaximum = static_cast<float>((1 << fo->bitsPerSample) - 1);
+				if (dither)
+					for (auto y = 0; y < 8; ++y)
+						for (auto x = 0; x < 8; ++x)
+							p.DitherRows[y][x] = (BayerMatrix[y][x] + .5f) / 64.f - .5f;
+			}
+			if (p.WidthMod8 == 0)
+				plan.kernels = &KernelsCPP[GetSampleIndex(fi)][GetSampleIndex(fo)];
+		}
+		return plan;
+	}
+	auto GetPlan(const VSFormat *fi, int width, int height, bool FullRange)->const ProcessingPlan & {
+		auto key = std::make_tuple(fi, width, height, FullRange);
+		{
+			std::shared_lock<std::shared_timed_mutex> lock{ PlanLock };
+			auto cached = plans.find(key);
+			if (cached != plans.end())
+				return cached->second;
+		}
+		std::lock_guard<std::shared_timed_mutex> lock{ PlanLock };
+		auto cached = plans.find(key);
+		if (cached == plans.end())
+			cached = plans.emplace(key, BuildPlan(fi, width, height, FullRange)).first;
+		return cached->second;
 	}
 	FixFadesData(FixFadesData &&) = delete;
 	FixFadesData(const FixFadesData &) = delete;
@@ -69,5 +530,14 @@ struct FixFadesData final {
 	auto &operator=(const FixFadesData &) = delete;
 	~FixFadesData() {
 		vsapi->freeNode(node);
+		vsapi->freeNode(reference);
 	}
 };
+
+static inline auto GetLeastSquaresGain(double TopSquareSum, double BottomSquareSum, double CrossSum) {
+	// orthogonal regression of the bottom field onto the top field
+	if (CrossSum <= 0.)
+		return 0.;
+	auto Spread = BottomSquareSum - TopSquareSum;
+	return (Spread + std::sqrt(Spread * Spread + 4. * CrossSum * CrossSum)) / (2. * CrossSum);
+}
@@ -1,112 +1,566 @@
 #include "Shared.hpp"
 
-extern auto VS_CC fixfadesGetFrame_AVX_FMA(int, int, void **, void **, VSFrameContext *, VSCore *, const VSAPI *)->const VSFrameRef *;
+namespace {
+	template<typename InputType>
+	auto SumField(const PlanePlan &p, const void *const *lines, int FirstLine, double &FieldSum) {
+		auto Field = ReductionLanes{};
+		auto LineCount = 0ll;
+		for (auto y = FirstLine; y < p.height; y += 2, ++LineCount) {
+			auto srcp = reinterpret_cast<const InputType *>(lines[y]);
+			for (auto x = 0; x < p.width; ++x)
+				Field.lanes[x % 8] += ToLinear(LoadSample(p, srcp[x]), p.transfer);
+		}
+		FieldSum += GetFieldSum(p, Field, LineCount);
+	}
+
+	template<typename InputType>
+	auto Moments(const PlanePlan &p, const void *const *lines, FieldMoments &m) {
+		auto TopField = ReductionLanes{}, BottomField = ReductionLanes{};
+		auto TopSquare = ReductionLanes{}, BottomSquare = ReductionLanes{}, Cross = ReductionLanes{};
+		auto Linearize = [&](auto y, auto x) {
+			return ToLinear(LoadSample(p, reinterpret_cast<const InputType *>(lines[y])[x]), p.transfer) - p.BaseColor;
+		};
+		for (auto y = 0; y < p.height; y += 2)
+			if (y + 1 < p.height)
+				for (auto x = 0; x < p.width; ++x) {
+					auto Top = Linearize(y, x);
+					auto Bottom = Linearize(y + 1, x);
+					TopField.lanes[x % 8] += Top;
+					BottomField.lanes[x % 8] += Bottom;
+					TopSquare.lanes[x % 8] += Top * Top;
+					BottomSquare.lanes[x % 8] += Bottom * Bottom;
+					Cross.lanes[x % 8] += Top * Bottom;
+				}
+			else
+				for (auto x = 0; x < p.width; ++x)
+					TopField.lanes[x % 8] += Linearize(y, x);
+		m.TopFieldSum += Reduce(TopField);
+		m.BottomFieldSum += Reduce(BottomField);
+		m.TopSquareSum += Reduce(TopSquare);
+		m.BottomSquareSum += Reduce(BottomSquare);
+		m.CrossSum += Reduce(Cross);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ConvertLine(const PlanePlan &p, const void *source, void *destination, int y) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		if (!p.ConvertSamples)
+			std::memcpy(dstp, srcp, p.width * sizeof(InputType));
+		else
+			for (auto x = 0; x < p.width; ++x)
+				StoreSample(p, LoadSample(p, srcp[x]), x, y, dstp[x]);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessLine(const PlanePlan &p, const void *source, void *destination, int y, double Gain) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		for (auto x = 0; x < p.width; ++x)
+			StoreSample(p, ApplyGain(p, LoadSample(p, srcp[x]), SingleGain), x, y, dstp[x]);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto CopySumLine(const PlanePlan &p, const void *source, void *destination, int y, ReductionLanes &Field) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		for (auto x = 0; x < p.width; ++x)
+			Field.lanes[x % 8] += ToLinear(LoadSample(p, srcp[x]), p.transfer);
+		if (destination != nullptr)
+			ConvertLine<InputType, OutputType>(p, source, destination, y);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessSumLine(const PlanePlan &p, const void *source, void *destination, int y, double Gain, ReductionLanes &Field) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		for (auto x = 0; x < p.width; ++x) {
+			auto Sample = LoadSample(p, srcp[x]);
+			Field.lanes[x % 8] += ToLinear(Sample, p.transfer);
+			StoreSample(p, ApplyGain(p, Sample, SingleGain), x, y, dstp[x]);
+		}
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessReferenceLine(const PlanePlan &p, const void *source, const void *reference, void *destination, int y, double Gain) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto refp = reinterpret_cast<const InputType *>(reference);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		for (auto x = 0; x < p.width; ++x)
+			StoreSample(p, ApplyGain(p, LoadSample(p, srcp[x]), SingleGain, ToLinear(LoadSample(p, refp[x]), p.transfer)), x, y, dstp[x]);
+	}
+
+	template<typename InputType, typename OutputType>
+	constexpr auto MakeKernels() {
+		return FixFadesKernels{ SumField<InputType>, Moments<InputType>, ConvertLine<InputType, OutputType>, ProcessLine<InputType, OutputType>,
+			CopySumLine<InputType, OutputType>, ProcessSumLine<InputType, OutputType>, ProcessReferenceLine<InputType, OutputType> };
+	}
+}
+
+extern const FixFadesKernels KernelsCPP[3][3] = {
+	{ MakeKernels<uint8_t, uint8_t>(), MakeKernels<uint8_t, uint16_t>(), MakeKernels<uint8_t, float>() },
+	{ MakeKernels<uint16_t, uint8_t>(), MakeKernels<uint16_t, uint16_t>(), MakeKernels<uint16_t, float>() },
+	{ MakeKernels<float, uint8_t>(), MakeKernels<float, uint16_t>(), MakeKernels<float, float>() }
+};
 
 auto VS_CC fixfadesInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
 	auto d = reinterpret_cast<FixFadesData *>(*instanceData);
-	vsapi->setVideoInfo(d->vi, 1, node);
+	vsapi->setVideoInfo(&d->OutputInfo, 1, node);
 }
 
 auto VS_CC fixfadesGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi)->const VSFrameRef * {
 	auto d = reinterpret_cast<FixFadesData *>(*instanceData);
-	if (activationReason == arInitial)
+	auto HasPartnerField = d->fields && (n ^ 1) < d->vi->numFrames;
+	if (activationReason == arInitial) {
 		vsapi->requestFrameFilter(n, d->node, frameCtx);
+		if (HasPartnerField)
+			vsapi->requestFrameFilter(n ^ 1, d->node, frameCtx);
+		if (d->cadence != -1 && (!d->fields || HasPartnerField))
+			for (auto i = 0; i < 2; ++i) {
+				auto unit = HasPartnerField ? n / 2 : n;
+				auto owner = static_cast<int>(GetFieldOwner(unit, d->cadence, d->tff != 0, i));
+				if (owner == unit)
+					continue;
+				vsapi->requestFrameFilter(HasPartnerField ? owner * 2 : owner, d->node, frameCtx);
+				if (HasPartnerField)
+					vsapi->requestFrameFilter(owner * 2 + 1, d->node, frameCtx);
+			}
+	}
+	else if (activationReason == arError) {
+		delete reinterpret_cast<ReferenceStage *>(*frameData);
+		*frameData = nullptr;
+	}
 	else if (activationReason == arAllFramesReady) {
+		auto stage = reinterpret_cast<ReferenceStage *>(*frameData);
 		auto src = vsapi->getFrameFilter(n, d->node, frameCtx);
-		auto fi = d->vi->format;
+		auto fi = vsapi->getFrameFormat(src);
 		auto height = vsapi->getFrameHeight(src, 0);
 		auto width = vsapi->getFrameWidth(src, 0);
-		auto dst = vsapi->newVideoFrame(fi, width, height, src, core);
-		for (auto plane = 0; plane < fi->numPlanes; ++plane) {
-			auto height = vsapi->getFrameHeight(src, plane);
-			auto width = vsapi->getFrameWidth(src, plane);
-			auto srcp = reinterpret_cast<const float **>(alloca(height * sizeof(void *)));
-			auto dstp = reinterpret_cast<float **>(alloca(height * sizeof(void *)));
-			auto TopFieldSum = 0., BottomFieldSum = 0., CurrentBaseColor = d->color[plane];
-			auto Initialize = [&]() {
-				auto src_stride = vsapi->getStride(src, plane) / sizeof(float);
-				auto dst_stride = vsapi->getStride(dst, plane) / sizeof(float);
-				for (auto i = 0; i < height; ++i) {
-					srcp[i] = reinterpret_cast<const float *>(vsapi->getReadPtr(src, plane)) + i * src_stride;
-					dstp[i] = reinterpret_cast<float *>(vsapi->getWritePtr(dst, plane)) + i * dst_stride;
+		// the 2 fields of a pair, woven by line pointers
+		const VSFrameRef *SourceFields[] = { src, src };
+		const VSFrameRef *ReferenceFields[] = { nullptr, nullptr };
+		const VSFrameRef *OwnerFields[] = { nullptr, nullptr };
+		auto PairHeight = height;
+		auto ReleaseFields = [&]() {
+			if (SourceFields[0] != SourceFields[1])
+				vsapi->freeFrame(SourceFields[0] == src ? SourceFields[1] : SourceFields[0]);
+			if (ReferenceFields[0] != ReferenceFields[1])
+				vsapi->freeFrame(ReferenceFields[1]);
+			vsapi->freeFrame(ReferenceFields[0]);
+			for (auto field : OwnerFields)
+				vsapi->freeFrame(field);
+		};
+		auto Fail = [&](auto message) {
+			vsapi->setFilterError(message, frameCtx);
+			ReleaseFields();
+			vsapi->freeFrame(src);
+			delete stage;
+			*frameData = nullptr;
+			return nullptr;
+		};
+		// row i of the woven frame
+		auto GetLines = [&](const VSFrameRef *const *fields, int plane, int height, const void **lines) {
+			for (auto i = 0; i < height; ++i) {
+				auto field = fields[i % 2];
+				auto row = HasPartnerField ? i / 2 : i;
+				lines[i] = vsapi->getReadPtr(field, plane) + row * vsapi->getStride(field, plane);
+			}
+		};
+		auto GetParity = [&](auto frame, auto index) {
+			auto err = 0;
+			if (d->tff != -1)
+				return static_cast<int64_t>((index % 2 == 0) == !!d->tff);
+			auto parity = vsapi->propGetInt(vsapi->getFramePropsRO(frame), "_Field", 0, &err);
+			return err ? static_cast<int64_t>(-1) : parity;
+		};
+		if (HasPartnerField) {
+			auto partner = vsapi->getFrameFilter(n ^ 1, d->node, frameCtx);
+			auto parity = GetParity(src, n);
+			SourceFields[0] = parity == 1 ? src : partner;
+			SourceFields[1] = parity == 1 ? partner : src;
+			if (parity == -1)
+				return Fail("FixFades: field separated input needs the _Field frame property or tff.");
+			if (GetParity(partner, n ^ 1) != 1 - parity)
+				return Fail("FixFades: frames of a field pair must have opposite parity.");
+			auto TopHeight = vsapi->getFrameHeight(SourceFields[0], 0);
+			auto BottomHeight = vsapi->getFrameHeight(SourceFields[1], 0);
+			if (vsapi->getFrameFormat(partner) != fi || vsapi->getFrameWidth(partner, 0) != width || (TopHeight != BottomHeight && TopHeight != BottomHeight + 1))
+				return Fail("FixFades: both fields of a pair must have the same format and dimensions.");
+			PairHeight = TopHeight + BottomHeight;
+		}
+		// RGB defaults to full range, everything else to limited
+		auto FullRange = false;
+		if (fi->sampleType == stInteger || (d->OutputFormat != nullptr && d->OutputFormat->sampleType == stInteger)) {
+			auto err = 0;
+			auto ColorRange = vsapi->propGetInt(vsapi->getFramePropsRO(src), "_ColorRange", 0, &err);
+			FullRange = err ? fi->colorFamily == cmRGB : ColorRange == 0;
+		}
+		auto &&plan = d->GetPlan(fi, width, PairHeight, FullRange);
+		if (plan.error != nullptr)
+			return Fail(plan.error);
+		auto &&kernels = *plan.kernels;
+		auto fo = plan.OutputFormat;
+		auto NewOutputFrame = [&]() {
+			auto frame = vsapi->newVideoFrame(fo, width, height, src, core);
+			if (fo->sampleType == stInteger)
+				vsapi->propSetInt(vsapi->getFramePropsRW(frame), "_ColorRange", FullRange ? 0 : 1, paReplace);
+			else if (fi->sampleType == stInteger)
+				vsapi->propDeleteKey(vsapi->getFramePropsRW(frame), "_ColorRange");
+			return frame;
+		};
+		// trailing unpaired field
+		if (d->fields && !HasPartnerField) {
+			if (fo == fi)
+				return src;
+			auto dst = NewOutputFrame();
+			for (auto plane = 0; plane < plan.numPlanes; ++plane)
+				for (auto y = 0; y < plan.planes[plane].height; ++y)
+					kernels.ConvertLine(plan.planes[plane], vsapi->getReadPtr(src, plane) + y * vsapi->getStride(src, plane), vsapi->getWritePtr(dst, plane) + y * vsapi->getStride(dst, plane), y);
+			vsapi->freeFrame(src);
+			return dst;
+		}
+		auto Pair = HasPartnerField ? static_cast<int64_t>(n / 2) : int64_t{ -1 };
+		double Thresholds[3] = {};
+		for (auto plane = 0; plane < plan.numPlanes; ++plane)
+			if (stage != nullptr)
+				Thresholds[plane] = stage->thresholds[plane];
+			else {
+				Thresholds[plane] = d->GetThreshold(plane);
+				// the adaptive threshold may move between the 2 frames of a pair
+				if (Pair != -1)
+					d->PairThresholds.Share(Pair, &plan, plane, Thresholds[plane]);
+			}
+		int64_t FieldIdentities[] = { -1, -1 };
+		if (d->cadence != -1)
+			for (auto i = 0; i < 2; ++i)
+				FieldIdentities[i] = GetFieldIdentity(HasPartnerField ? n / 2 : n, d->cadence, d->tff != 0, i);
+		if (d->cadence != -1 && stage == nullptr)
+			for (auto i = 0; i < 2; ++i) {
+				auto unit = HasPartnerField ? n / 2 : n;
+				auto owner = static_cast<int>(GetFieldOwner(unit, d->cadence, d->tff != 0, i));
+				if (owner == unit)
+					continue;
+				auto index = HasPartnerField ? owner * 2 : owner;
+				auto field = vsapi->getFrameFilter(index, d->node, frameCtx);
+				if (HasPartnerField && GetParity(field, index) != 1 - i) {
+					vsapi->freeFrame(field);
+					field = vsapi->getFrameFilter(++index, d->node, frameCtx);
+				}
+				auto FieldHeight = HasPartnerField ? vsapi->getFrameHeight(SourceFields[i], 0) : height;
+				// mismatching first appearance, reduced in place and kept out of the cache
+				if ((HasPartnerField && GetParity(field, index) != 1 - i) || vsapi->getFrameFormat(field) != fi || vsapi->getFrameWidth(field, 0) != width || vsapi->getFrameHeight(field, 0) != FieldHeight) {
+					vsapi->freeFrame(field);
+					FieldIdentities[i] = -1;
+				}
+				else
+					OwnerFields[i] = field;
+			}
+		// repeats are reduced on OwnerFields, the frame of their first appearance
+		auto SumSourceField = [&](const PlanePlan &p, int plane, const void *const *srcp, int field, double &FieldSum, int64_t &BytesRead) {
+			auto Sum = 0.;
+			if (FieldIdentities[field] == -1 || !d->CadenceCache.Fetch(FieldIdentities[field], &plan, plane, Sum)) {
+				auto lines = srcp;
+				if (OwnerFields[field] != nullptr) {
+					const VSFrameRef *OwnerField[] = { OwnerFields[field], OwnerFields[field] };
+					auto OwnerLines = reinterpret_cast<const void **>(alloca(p.height * sizeof(void *)));
+					GetLines(OwnerField, plane, p.height, OwnerLines);
+					lines = OwnerLines;
+				}
+				kernels.SumField(p, lines, field, Sum);
+				BytesRead += static_cast<int64_t>(p.width) * ((p.height + 1 - field) / 2) * fi->bytesPerSample;
+				if (FieldIdentities[field] != -1)
+					d->CadenceCache.Store(FieldIdentities[field], &plan, plane, Sum);
+			}
+			FieldSum += Sum;
+		};
+		// shared by both frames of a pair
+		auto SumSourceFields = [&](const PlanePlan &p, int plane, const void *const *srcp, double &TopFieldSum, double &BottomFieldSum, int64_t &BytesRead) {
+			auto PairSums = FieldMoments{};
+			if (Pair == -1 || !d->PairCache.Fetch(Pair, &plan, plane, PairSums)) {
+				SumSourceField(p, plane, srcp, 0, PairSums.TopFieldSum, BytesRead);
+				SumSourceField(p, plane, srcp, 1, PairSums.BottomFieldSum, BytesRead);
+				if (Pair != -1)
+					d->PairCache.Store(Pair, &plan, plane, PairSums);
+			}
+			TopFieldSum += PairSums.TopFieldSum;
+			BottomFieldSum += PairSums.BottomFieldSum;
+		};
+		if (d->reference != nullptr && stage == nullptr) {
+			// first activation, decided on the source sums
+			auto next = new ReferenceStage{};
+			auto AnyCorrected = false;
+			for (auto plane = 0; plane < plan.numPlanes; ++plane) {
+				auto &&p = plan.planes[plane];
+				if (plane > 0 && d->chroma != 0) {
+					next->corrected[plane] = d->chroma == 1 && next->corrected[0];
+					continue;
 				}
+				auto srcp = reinterpret_cast<const void **>(alloca(p.height * sizeof(void *)));
+				GetLines(SourceFields, plane, p.height, srcp);
+				SumSourceFields(p, plane, srcp, next->sums[plane][0], next->sums[plane][1], next->BytesRead);
+				auto NormalizedDifference = std::abs(next->sums[plane][0] - next->sums[plane][1]) / p.FieldPixelCount;
+				next->thresholds[plane] = Thresholds[plane];
+				next->corrected[plane] = NormalizedDifference >= Thresholds[plane];
+				AnyCorrected |= next->corrected[plane];
+				if (d->CollectStatistics)
+					d->statistics.RecordPlane(plane, NormalizedDifference, next->corrected[plane]);
+			}
+			if (!AnyCorrected && fo == fi) {
+				if (d->CollectStatistics)
+					d->statistics.RecordFrame(d->mode, false, next->BytesRead, 0);
+				ReleaseFields();
+				delete next;
+				return src;
+			}
+			// untouched but converted, no reference needed
+			*frameData = stage = next;
+			if (AnyCorrected) {
+				next->ReferenceRequested = true;
+				vsapi->requestFrameFilter(n, d->reference, frameCtx);
+				if (HasPartnerField)
+					vsapi->requestFrameFilter(n ^ 1, d->reference, frameCtx);
+				ReleaseFields();
+				vsapi->freeFrame(src);
+				return nullptr;
+			}
+		}
+		else if (stage != nullptr) {
+			auto ReferenceFrame = vsapi->getFrameFilter(n, d->reference, frameCtx);
+			ReferenceFields[0] = ReferenceFields[1] = ReferenceFrame;
+			if (HasPartnerField)
+				ReferenceFields[SourceFields[0] == src ? 1 : 0] = vsapi->getFrameFilter(n ^ 1, d->reference, frameCtx);
+			for (auto i = 0; i < 2; ++i)
+				if (vsapi->getFrameFormat(ReferenceFields[i]) != fi || vsapi->getFrameWidth(ReferenceFields[i], 0) != width || vsapi->getFrameHeight(ReferenceFields[i], 0) != vsapi->getFrameHeight(SourceFields[i], 0))
+					return Fail("FixFades: reference must have the same format and dimensions as clip!");
+		}
+		auto dst = NewOutputFrame();
+		FieldMoments FrameSums[3], PredictedSums[3];
+		auto FrameCorrected = stage != nullptr && stage->ReferenceRequested;
+		auto BytesRead = stage != nullptr ? stage->BytesRead : int64_t{ 0 };
+		auto BytesWritten = int64_t{ 0 };
+		auto LumaGains = FieldGains{};
+		auto PredictionFound = d->predict && d->FetchPrediction(n, HasPartnerField ? 2 : 1, &plan, PredictedSums);
+		for (auto plane = 0; plane < plan.numPlanes; ++plane) {
+			auto &&p = plan.planes[plane];
+			auto height = p.height;
+			auto width = p.width;
+			auto srcp = reinterpret_cast<const void **>(alloca(height * sizeof(void *)));
+			auto dstp = reinterpret_cast<void **>(alloca(height * sizeof(void *)));
+			auto refp = ReferenceFields[0] != nullptr ? reinterpret_cast<const void **>(alloca(height * sizeof(void *))) : nullptr;
+			auto TopFieldSum = 0., BottomFieldSum = 0.;
+			auto AppliedGains = FieldGains{};
+			auto PlaneBytes = static_cast<int64_t>(width) * height * fi->bytesPerSample;
+			auto SourceBytes = static_cast<int64_t>(width) * vsapi->getFrameHeight(src, plane) * fi->bytesPerSample;
+			auto OutputBytes = static_cast<int64_t>(width) * vsapi->getFrameHeight(src, plane) * fo->bytesPerSample;
+			auto Initialize = [&]() {
+				auto dst_stride = vsapi->getStride(dst, plane);
+				GetLines(SourceFields, plane, height, srcp);
+				for (auto i = 0; i < height; ++i)
+					dstp[i] = SourceFields[i % 2] == src ? vsapi->getWritePtr(dst, plane) + (HasPartnerField ? i / 2 : i) * dst_stride : nullptr;
+				if (refp != nullptr)
+					GetLines(ReferenceFields, plane, height, refp);
 			};
 			auto FixFadesPrepare = [&]() {
-				for (auto y = 0; y < height; ++y)
-					if (y % 2 == false)
-						for (auto x = 0; x < width; ++x)
-							TopFieldSum += srcp[y][x] - CurrentBaseColor;
-					else
-						for (auto x = 0; x < width; ++x)
-							BottomFieldSum += srcp[y][x] - CurrentBaseColor;
+				SumSourceFields(p, plane, srcp, TopFieldSum, BottomFieldSum, BytesRead);
 			};
-			auto FixFadesMode0 = [&]() {
-				auto MeanSum = (TopFieldSum + BottomFieldSum) / 2.;
-				for (auto y = 0; y < height; ++y)
-					if (y % 2 == false)
-						for (auto x = 0; x < width; ++x)
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MeanSum / TopFieldSum + CurrentBaseColor);
-					else
-						for (auto x = 0; x < width; ++x)
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MeanSum / BottomFieldSum + CurrentBaseColor);
-			};
-			auto FixFadesMode1 = [&]() {
-				auto MinSum = std::min(TopFieldSum, BottomFieldSum);
-				if (MinSum == TopFieldSum)
-					for (auto y = 1; y < height; y += 2)
-						for (auto x = 0; x < width; ++x) {
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MinSum / BottomFieldSum + CurrentBaseColor);
-							dstp[y - 1][x] = srcp[y - 1][x];
-						}
-				else
-					for (auto y = 0; y < height; y += 2)
-						for (auto x = 0; x < width; ++x) {
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MinSum / TopFieldSum + CurrentBaseColor);
-							dstp[y + 1][x] = srcp[y + 1][x];
-						}
-			};
-			auto FixFadesMode2 = [&]() {
-				auto MaxSum = std::max(TopFieldSum, BottomFieldSum);
-				if (MaxSum == TopFieldSum)
-					for (auto y = 1; y < height; y += 2)
-						for (auto x = 0; x < width; ++x) {
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MaxSum / BottomFieldSum + CurrentBaseColor);
-							dstp[y - 1][x] = srcp[y - 1][x];
-						}
-				else
-					for (auto y = 0; y < height; y += 2)
-						for (auto x = 0; x < width; ++x) {
-							dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * MaxSum / TopFieldSum + CurrentBaseColor);
-							dstp[y + 1][x] = srcp[y + 1][x];
-						}
+			auto FieldMomentsStorage = FieldMoments{};
+			auto FixFadesPrepareLeastSquares = [&]() {
+				if (Pair == -1 || !d->PairCache.Fetch(Pair, &plan, plane, FieldMomentsStorage)) {
+					kernels.Moments(p, srcp, FieldMomentsStorage);
+					BytesRead += PlaneBytes;
+					if (Pair != -1)
+						d->PairCache.Store(Pair, &plan, plane, FieldMomentsStorage);
+				}
+				TopFieldSum = FieldMomentsStorage.TopFieldSum;
+				BottomFieldSum = FieldMomentsStorage.BottomFieldSum;
 			};
-			auto GetNormalizedDifference = [&]() {
-				auto FieldPixelCount = static_cast<int64_t>(width) * height / 2;
-				return std::abs(TopFieldSum - BottomFieldSum) / FieldPixelCount;
+			auto ApplyLeastSquaresGain = [&]() {
+				auto Gain = GetLeastSquaresGain(FieldMomentsStorage.TopSquareSum, FieldMomentsStorage.BottomSquareSum, FieldMomentsStorage.CrossSum);
+				if (Gain > 0. && std::isfinite(Gain))
+					BottomFieldSum = TopFieldSum * Gain;
 			};
-			auto CopyToDestinationFrame = [&]() {
-				std::memcpy(dstp[0], srcp[0], width * height * sizeof(float));
+			auto CopyLine = [&](auto y) {
+				if (dstp[y] != nullptr)
+					kernels.ConvertLine(p, srcp[y], dstp[y], y);
 			};
-			Initialize();
-			FixFadesPrepare();
-			if (GetNormalizedDifference() < d->threshold)
-				CopyToDestinationFrame();
-			else
+			auto GetFieldGains = [&](auto TopFieldSum, auto BottomFieldSum) {
+				auto gains = FieldGains{};
+				auto SetGain = [&](auto field, auto FieldSum, auto ReferenceSum) {
+					auto Gain = ReferenceSum / FieldSum;
+					if (Gain > 0. && std::isfinite(Gain)) {
+						gains.gains[field] = Gain;
+						gains.copy[field] = false;
+					}
+				};
 				switch (d->mode) {
-				case 0:
-					FixFadesMode0();
+				case 0: {
+					auto MeanSum = (TopFieldSum + BottomFieldSum) / 2.;
+					SetGain(0, TopFieldSum, MeanSum);
+					SetGain(1, BottomFieldSum, MeanSum);
 					break;
-				case 1:
-					FixFadesMode1();
+				}
+				case 1: {
+					auto MinSum = std::min(TopFieldSum, BottomFieldSum);
+					if (MinSum == TopFieldSum)
+						SetGain(1, BottomFieldSum, MinSum);
+					else
+						SetGain(0, TopFieldSum, MinSum);
 					break;
-				case 2:
-					FixFadesMode2();
+				}
+				case 2: {
+					auto MaxSum = std::max(TopFieldSum, BottomFieldSum);
+					if (MaxSum == TopFieldSum)
+						SetGain(1, BottomFieldSum, MaxSum);
+					else
+						SetGain(0, TopFieldSum, MaxSum);
 					break;
+				}
 				default:
 					break;
 				}
+				return gains;
+			};
+			auto IsPassthrough = [&](auto TopFieldSum, auto BottomFieldSum) {
+				return std::abs(TopFieldSum - BottomFieldSum) / p.FieldPixelCount < Thresholds[plane];
+			};
+			auto Correct = [&](const FieldGains &gains) {
+				for (auto y = 0; y < height; ++y)
+					if (gains.copy[y % 2])
+						CopyLine(y);
+					else if (dstp[y] != nullptr && refp != nullptr)
+						kernels.ProcessReferenceLine(p, srcp[y], refp[y], dstp[y], y, gains.gains[y % 2]);
+					else if (dstp[y] != nullptr)
+						kernels.ProcessLine(p, srcp[y], dstp[y], y, gains.gains[y % 2]);
+			};
+			auto CopyToDestinationFrame = [&]() {
+				if (!p.ConvertSamples)
+					vs_bitblt(vsapi->getWritePtr(dst, plane), vsapi->getStride(dst, plane), vsapi->getReadPtr(src, plane), vsapi->getStride(src, plane), width * fi->bytesPerSample, vsapi->getFrameHeight(src, plane));
+				else
+					for (auto y = 0; y < height; ++y)
+						CopyLine(y);
+			};
+			// false when the plane has to be corrected again with the exact gains
+			auto FixFadesPredicted = [&](auto PredictedTopSum, auto PredictedBottomSum) {
+				auto PredictedPassthrough = IsPassthrough(PredictedTopSum, PredictedBottomSum);
+				auto predicted = PredictedPassthrough ? FieldGains{} : GetFieldGains(PredictedTopSum, PredictedBottomSum);
+				AppliedGains = predicted;
+				ReductionLanes Fields[2];
+				int64_t LineCount[] = { 0, 0 };
+				for (auto y = 0; y < height; ++y) {
+					if (predicted.copy[y % 2] || dstp[y] == nullptr)
+						kernels.CopySumLine(p, srcp[y], dstp[y], y, Fields[y % 2]);
+					else
+						kernels.ProcessSumLine(p, srcp[y], dstp[y], y, predicted.gains[y % 2], Fields[y % 2]);
+					++LineCount[y % 2];
+				}
+				TopFieldSum = GetFieldSum(p, Fields[0], LineCount[0]);
+				BottomFieldSum = GetFieldSum(p, Fields[1], LineCount[1]);
+				if (IsPassthrough(TopFieldSum, BottomFieldSum) || PredictedPassthrough)
+					return IsPassthrough(TopFieldSum, BottomFieldSum) == PredictedPassthrough;
+				auto exact = GetFieldGains(TopFieldSum, BottomFieldSum);
+				for (auto i = 0; i < 2; ++i)
+					if (exact.copy[i] != predicted.copy[i] || std::abs(exact.gains[i] - predicted.gains[i]) > d->tolerance * std::abs(exact.gains[i]))
+						return false;
+				return true;
+			};
+			auto PredictionAccepted = false;
+			Initialize();
+			// chroma=1 reuses the luma gains
+			if (plane > 0 && d->chroma != 0) {
+				if (d->chroma == 1 && (!LumaGains.copy[0] || !LumaGains.copy[1])) {
+					Correct(LumaGains);
+					if (refp != nullptr)
+						BytesRead += SourceBytes;
+				}
+				else
+					CopyToDestinationFrame();
+				BytesRead += SourceBytes;
+				BytesWritten += OutputBytes;
+				if (p.NonTemporal)
+					_mm_sfence();
+				continue;
+			}
+			// second activation, sums relative to the reference
+			if (stage != nullptr) {
+				AppliedGains = FieldGains{};
+				if (stage->corrected[plane]) {
+					auto ReferenceSums = FieldMoments{};
+					if (Pair == -1 || !d->ReferencePairCache.Fetch(Pair, &plan, plane, ReferenceSums)) {
+						kernels.SumField(p, refp, 0, ReferenceSums.TopFieldSum);
+						kernels.SumField(p, refp, 1, ReferenceSums.BottomFieldSum);
+						BytesRead += PlaneBytes;
+						if (Pair != -1)
+							d->ReferencePairCache.Store(Pair, &plan, plane, ReferenceSums);
+					}
+					TopFieldSum = stage->sums[plane][0] - ReferenceSums.TopFieldSum;
+					BottomFieldSum = stage->sums[plane][1] - ReferenceSums.BottomFieldSum;
+					if (!IsPassthrough(TopFieldSum, BottomFieldSum))
+						AppliedGains = GetFieldGains(TopFieldSum, BottomFieldSum);
+				}
+				if (!AppliedGains.copy[0] || !AppliedGains.copy[1]) {
+					Correct(AppliedGains);
+					BytesRead += SourceBytes;
+				}
+				else
+					CopyToDestinationFrame();
+				BytesRead += SourceBytes;
+				BytesWritten += OutputBytes;
+				if (plane == 0)
+					LumaGains = AppliedGains;
+				if (p.NonTemporal)
+					_mm_sfence();
+				continue;
+			}
+			// exact sums of the other frame of the pair beat a prediction
+			auto PairSummed = d->predict && Pair != -1 && d->PairCache.Fetch(Pair, &plan, plane, FieldMomentsStorage);
+			if (PredictionFound && !PairSummed) {
+				PredictionAccepted = FixFadesPredicted(PredictedSums[plane].TopFieldSum, PredictedSums[plane].BottomFieldSum);
+				BytesRead += PlaneBytes;
+				BytesWritten += OutputBytes;
+				if (d->CollectStatistics)
+					d->statistics.RecordPrediction(PredictionAccepted);
+				if (Pair != -1)
+					d->PairCache.Store(Pair, &plan, plane, FieldMoments{ TopFieldSum, BottomFieldSum });
+			}
+			else if (d->estimator == 1)
+				FixFadesPrepareLeastSquares();
+			else
+				FixFadesPrepare();
+			FrameSums[plane].TopFieldSum = TopFieldSum;
+			FrameSums[plane].BottomFieldSum = BottomFieldSum;
+			auto NormalizedDifference = std::abs(TopFieldSum - BottomFieldSum) / p.FieldPixelCount;
+			FrameCorrected |= NormalizedDifference >= Thresholds[plane];
+			if (d->CollectStatistics)
+				d->statistics.RecordPlane(plane, NormalizedDifference, NormalizedDifference >= Thresholds[plane]);
+			if (!PredictionAccepted) {
+				BytesRead += SourceBytes;
+				BytesWritten += OutputBytes;
+				AppliedGains = FieldGains{};
+				if (NormalizedDifference < Thresholds[plane])
+					CopyToDestinationFrame();
+				else {
+					if (d->estimator == 1)
+						ApplyLeastSquaresGain();
+					AppliedGains = GetFieldGains(TopFieldSum, BottomFieldSum);
+					Correct(AppliedGains);
+				}
+			}
+			if (plane == 0)
+				LumaGains = AppliedGains;
+			if (p.NonTemporal)
+				_mm_sfence();
 		}
+		if (d->predict)
+			for (auto plane = 0; plane < plan.numPlanes; ++plane)
+				d->PredictionCache.Store(n, &plan, plane, FrameSums[plane]);
+		if (d->CollectStatistics)
+			d->statistics.RecordFrame(d->mode, FrameCorrected, BytesRead, BytesWritten);
+		ReleaseFields();
 		vsapi->freeFrame(src);
+		delete stage;
+		*frameData = nullptr;
 		return dst;
 	}
 	return nullptr;
@@ -114,17 +568,17 @@ auto VS_CC fixfadesGetFrame(int n, int activationReason, void **instanceData, vo
 
 auto VS_CC fixfadesFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
 	auto d = reinterpret_cast<FixFadesData *>(instanceData);
+	if (!d->StatisticsPath.empty() && !d->statistics.Export(d->StatisticsPath))
+		vsapi->logMessage(mtWarning, ("FixFades: failed to export statistics to " + d->StatisticsPath + "!").c_str());
+	if (!d->ReportPath.empty() && !d->statistics.Report(d->ReportPath, d->threshold, d->mode))
+		vsapi->logMessage(mtWarning, ("FixFades: failed to write the report to " + d->ReportPath + "!").c_str());
 	delete d;
 }
 
 auto VS_CC fixfadesCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
-	auto d = new FixFadesData{ in, out, vsapi };
-	auto CPU = CPUFeatures{};
+	auto d = new FixFadesData{ in, out, vsapi, core };
 	if (!d->illformed)
-		if (d->optimization && CPU.avx && CPU.fma3)
-			vsapi->createFilter(in, out, "FixFades", fixfadesInit, fixfadesGetFrame_AVX_FMA, fixfadesFree, fmParallel, 0, d, core);
-		else
-			vsapi->createFilter(in, out, "FixFades", fixfadesInit, fixfadesGetFrame, fixfadesFree, fmParallel, 0, d, core);
+		vsapi->createFilter(in, out, "FixFades", fixfadesInit, fixfadesGetFrame, fixfadesFree, fmParallel, 0, d, core);
 	else
 		delete d;
 }
@@ -133,9 +587,24 @@ VS_EXTERNAL_API(auto) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
 	configFunc("com.deinterlace.ftf", "ftf", "Fix Telecined Fades", VAPOURSYNTH_API_VERSION, 1, plugin);
 	registerFunc("FixFades",
 		"clip:clip;"
+		"reference:clip:opt;"
 		"mode:int:opt;"
+		"estimator:int:opt;"
 		"threshold:float:opt;"
+		"adaptive:float:opt;"
 		"color:float[]:opt;"
+		"transfer:int:opt;"
+		"chroma:int:opt;"
+		"fields:int:opt;"
+		"tff:int:opt;"
+		"cadence:int:opt;"
+		"statsin:data[]:opt;"
+		"statsout:data:opt;"
+		"report:data:opt;"
+		"predict:int:opt;"
+		"tolerance:float:opt;"
+		"format:int:opt;"
+		"dither:int:opt;"
 		"opt:int:opt;"
 		, fixfadesCreate, nullptr, plugin);
 }
@@ -1,131 +1,360 @@
 #include "Shared.hpp"
 
-auto VS_CC fixfadesGetFrame_AVX_FMA(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi)->const VSFrameRef * {
-	auto d = reinterpret_cast<FixFadesData *>(*instanceData);
-	if (activationReason == arInitial)
-		vsapi->requestFrameFilter(n, d->node, frameCtx);
-	else if (activationReason == arAllFramesReady) {
-		auto src = vsapi->getFrameFilter(n, d->node, frameCtx);
-		auto fi = d->vi->format;
-		auto height = vsapi->getFrameHeight(src, 0);
-		auto width = vsapi->getFrameWidth(src, 0);
-		auto dst = vsapi->newVideoFrame(fi, width, height, src, core);
-		for (auto plane = 0; plane < fi->numPlanes; ++plane) {
-			auto height = vsapi->getFrameHeight(src, plane);
-			auto width = vsapi->getFrameWidth(src, plane);
-			auto srcp = reinterpret_cast<const float **>(alloca(height * sizeof(void *)));
-			auto dstp = reinterpret_cast<float **>(alloca(height * sizeof(void *)));
-			auto TopFieldSum = 0., BottomFieldSum = 0., CurrentBaseColor = d->color[plane];
-			constexpr auto BitMask = (0xFFFFFFFFFFFFFFFFull >> 3) << 3;
-			auto WidthMod8 = width & BitMask;
-			auto FieldPixelCount = static_cast<int64_t>(width) * height / 2;
-			auto Initialize = [&]() {
-				auto src_stride = vsapi->getStride(src, plane) / sizeof(float);
-				auto dst_stride = vsapi->getStride(dst, plane) / sizeof(float);
-				for (auto i = 0; i < height; ++i) {
-					srcp[i] = reinterpret_cast<const float *>(vsapi->getReadPtr(src, plane)) + i * src_stride;
-					dstp[i] = reinterpret_cast<float *>(vsapi->getWritePtr(dst, plane)) + i * dst_stride;
-				}
-			};
-			auto GetNormalizedDifference = [&]() {
-				return std::abs(TopFieldSum - BottomFieldSum) / FieldPixelCount;
-			};
-			auto CopyToDestinationFrame = [&]() {
-				std::memcpy(dstp[0], srcp[0], width * height * sizeof(float));
-			};
-			auto CopyLine = [&](auto y) {
-				std::memcpy(dstp[y], srcp[y], width * sizeof(float));
-			};
-			auto ProcessLine = [&](auto y, auto FieldSum, auto ReferenceSum) {
-				auto &&YMMCurrentBaseColor = _mm256_set1_ps(static_cast<float>(CurrentBaseColor));
-				auto &&YMMFieldReference = _mm256_set1_ps(static_cast<float>(ReferenceSum / FieldSum));
-				for (auto x = WidthMod8; x < width; ++x)
-					dstp[y][x] = static_cast<float>((srcp[y][x] - CurrentBaseColor) * ReferenceSum / FieldSum + CurrentBaseColor);
-				for (auto x = 0; x < WidthMod8; x += 8) {
-					auto &&YMM0 = _mm256_sub_ps(reinterpret_cast<const __m256 &>(srcp[y][x]), YMMCurrentBaseColor);
-					_mm256_store_ps(&dstp[y][x], _mm256_fmadd_ps(YMM0, YMMFieldReference, YMMCurrentBaseColor));
+namespace {
+	using ::ToLinear;
+	using ::FromLinear;
+
+	// no 256-bit integer ops in AVX, SSE halves
+	auto ShiftRight23(__m256 x) {
+		auto &&Bits = _mm256_castps_si256(x);
+		auto &&Low = _mm_srli_epi32(_mm256_castsi256_si128(Bits), 23);
+		auto &&High = _mm_srli_epi32(_mm256_extractf128_si256(Bits, 1), 23);
+		return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(Low), High, 1));
+	}
+
+	auto ExponentToScale(__m256 x) {
+		auto &&Integer = _mm256_cvtps_epi32(x);
+		auto &&Bias = _mm_set1_epi32(127);
+		auto &&Low = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(Integer), Bias), 23);
+		auto &&High = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(Integer, 1), Bias), 23);
+		return _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(Low), High, 1));
+	}
+
+	auto Log2(__m256 x) {
+		using namespace TransferApproximation;
+		auto &&Exponent = _mm256_sub_ps(ShiftRight23(x), _mm256_set1_ps(127.f));
+		auto &&Mantissa = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007FFFFF))), _mm256_set1_ps(1.f));
+		auto &&Mask = _mm256_cmp_ps(Mantissa, _mm256_set1_ps(Sqrt2), _CMP_GT_OQ);
+		Mantissa = _mm256_blendv_ps(Mantissa, _mm256_mul_ps(Mantissa, _mm256_set1_ps(0.5f)), Mask);
+		Exponent = _mm256_add_ps(Exponent, _mm256_and_ps(Mask, _mm256_set1_ps(1.f)));
+		auto &&t = _mm256_div_ps(_mm256_sub_ps(Mantissa, _mm256_set1_ps(1.f)), _mm256_add_ps(Mantissa, _mm256_set1_ps(1.f)));
+		auto &&t2 = _mm256_mul_ps(t, t);
+		auto &&Polynomial = _mm256_fmadd_ps(t2, _mm256_set1_ps(Log2Coefficients[4]), _mm256_set1_ps(Log2Coefficients[3]));
+		Polynomial = _mm256_fmadd_ps(Polynomial, t2, _mm256_set1_ps(Log2Coefficients[2]));
+		Polynomial = _mm256_fmadd_ps(Polynomial, t2, _mm256_set1_ps(Log2Coefficients[1]));
+		Polynomial = _mm256_fmadd_ps(Polynomial, t2, _mm256_set1_ps(Log2Coefficients[0]));
+		return _mm256_fmadd_ps(Polynomial, t, Exponent);
+	}
+
+	auto Exp2(__m256 x) {
+		using namespace TransferApproximation;
+		x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.f)), _mm256_set1_ps(126.f));
+		auto &&Integer = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		auto &&Fraction = _mm256_sub_ps(x, Integer);
+		auto &&Polynomial = _mm256_set1_ps(Exp2Coefficients[7]);
+		for (auto i = 6; i >= 0; --i)
+			Polynomial = _mm256_fmadd_ps(Polynomial, Fraction, _mm256_set1_ps(Exp2Coefficients[i]));
+		return _mm256_mul_ps(Polynomial, ExponentToScale(Integer));
+	}
+
+	auto Pow(__m256 x, float Exponent) {
+		auto &&Positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+		return _mm256_and_ps(Exp2(_mm256_mul_ps(_mm256_set1_ps(Exponent), Log2(x))), Positive);
+	}
+
+	auto CopySign(__m256 Magnitude, __m256 x) {
+		auto &&SignMask = _mm256_set1_ps(-0.f);
+		return _mm256_or_ps(_mm256_andnot_ps(SignMask, Magnitude), _mm256_and_ps(SignMask, x));
+	}
+
+	auto ToLinear(__m256 x, int64_t Transfer) {
+		using namespace TransferApproximation;
+		auto &&Magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+		switch (Transfer) {
+		case TransferBT1886:
+			return CopySign(Pow(Magnitude, BT1886Gamma), x);
+		case TransferSRGB: {
+			auto &&Segment = _mm256_div_ps(Magnitude, _mm256_set1_ps(SRGBSlope));
+			auto &&Curve = Pow(_mm256_div_ps(_mm256_add_ps(Magnitude, _mm256_set1_ps(SRGBOffset)), _mm256_set1_ps(SRGBScale)), SRGBGamma);
+			return CopySign(_mm256_blendv_ps(Curve, Segment, _mm256_cmp_ps(Magnitude, _mm256_set1_ps(SRGBLinearThreshold), _CMP_LE_OQ)), x);
+		}
+		case TransferPQ: {
+			auto &&Encoded = Pow(_mm256_max_ps(x, _mm256_setzero_ps()), 1.f / PQm2);
+			auto &&Numerator = _mm256_max_ps(_mm256_sub_ps(Encoded, _mm256_set1_ps(PQc1)), _mm256_setzero_ps());
+			return Pow(_mm256_div_ps(Numerator, _mm256_fmadd_ps(_mm256_set1_ps(-PQc3), Encoded, _mm256_set1_ps(PQc2))), 1.f / PQm1);
+		}
+		default:
+			return x;
+		}
+	}
+
+	auto FromLinear(__m256 x, int64_t Transfer) {
+		using namespace TransferApproximation;
+		auto &&Magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+		switch (Transfer) {
+		case TransferBT1886:
+			return CopySign(Pow(Magnitude, 1.f / BT1886Gamma), x);
+		case TransferSRGB: {
+			auto &&Segment = _mm256_mul_ps(Magnitude, _mm256_set1_ps(SRGBSlope));
+			auto &&Curve = _mm256_fmadd_ps(_mm256_set1_ps(SRGBScale), Pow(Magnitude, 1.f / SRGBGamma), _mm256_set1_ps(-SRGBOffset));
+			return CopySign(_mm256_blendv_ps(Curve, Segment, _mm256_cmp_ps(Magnitude, _mm256_set1_ps(SRGBEncodedThreshold), _CMP_LE_OQ)), x);
+		}
+		case TransferPQ: {
+			auto &&Linear = Pow(_mm256_max_ps(x, _mm256_setzero_ps()), PQm1);
+			auto &&Numerator = _mm256_fmadd_ps(_mm256_set1_ps(PQc2), Linear, _mm256_set1_ps(PQc1));
+			return Pow(_mm256_div_ps(Numerator, _mm256_fmadd_ps(_mm256_set1_ps(PQc3), Linear, _mm256_set1_ps(1.f))), PQm2);
+		}
+		default:
+			return x;
+		}
+	}
+
+	auto Linearize(__m256 x, int64_t Transfer) {
+		return Transfer == TransferLinear ? x : ToLinear(x, Transfer);
+	}
+
+	auto Delinearize(__m256 x, int64_t Transfer) {
+		return Transfer == TransferLinear ? x : FromLinear(x, Transfer);
+	}
+
+	auto ToDouble(__m256 x, __m256d (&y)[2]) {
+		y[0] = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+		y[1] = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+	}
+
+	auto LoadVector(const PlanePlan &, const float *srcp) {
+		return _mm256_load_ps(srcp);
+	}
+
+	auto Normalize(const PlanePlan &p, __m128i Low, __m128i High) {
+		auto &&x = _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(Low), High, 1));
+		return _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p.InputScale)), _mm256_set1_ps(p.InputOffset));
+	}
+
+	auto LoadVector(const PlanePlan &p, const uint16_t *srcp) {
+		auto &&Samples = _mm_load_si128(reinterpret_cast<const __m128i *>(srcp));
+		return Normalize(p, _mm_cvtepu16_epi32(Samples), _mm_cvtepu16_epi32(_mm_srli_si128(Samples, 8)));
+	}
+
+	auto LoadVector(const PlanePlan &p, const uint8_t *srcp) {
+		auto &&Samples = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(srcp));
+		return Normalize(p, _mm_cvtepu8_epi32(Samples), _mm_cvtepu8_epi32(_mm_srli_si128(Samples, 4)));
+	}
+
+	auto StoreVector(const PlanePlan &p, float *dstp, int, __m256 x) {
+		if (p.NonTemporal)
+			_mm256_stream_ps(dstp, x);
+		else
+			_mm256_store_ps(dstp, x);
+	}
+
+	auto Quantize(const PlanePlan &p, int y, __m256 x) {
+		auto &&Value = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p.OutputScale)), _mm256_set1_ps(p.OutputOffset)), _mm256_loadu_ps(p.DitherRows[y % 8]));
+		Value = _mm256_min_ps(_mm256_max_ps(Value, _mm256_setzero_ps()), _mm256_set1_ps(p.OutputMaximum));
+		auto &&Integer = _mm256_cvtps_epi32(Value);
+		return _mm_packus_epi32(_mm256_castsi256_si128(Integer), _mm256_extractf128_si256(Integer, 1));
+	}
+
+	auto StoreVector(const PlanePlan &p, uint16_t *dstp, int y, __m256 x) {
+		auto &&Samples = Quantize(p, y, x);
+		if (p.NonTemporal)
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dstp), Samples);
+		else
+			_mm_store_si128(reinterpret_cast<__m128i *>(dstp), Samples);
+	}
+
+	auto StoreVector(const PlanePlan &p, uint8_t *dstp, int y, __m256 x) {
+		auto &&Samples = Quantize(p, y, x);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dstp), _mm_packus_epi16(Samples, Samples));
+	}
+
+	template<typename InputType>
+	auto SumField(const PlanePlan &p, const void *const *lines, int FirstLine, double &FieldSum) {
+		auto Field = ReductionLanes{};
+		auto LineCount = 0ll;
+		for (auto y = FirstLine; y < p.height; y += 2, ++LineCount) {
+			auto srcp = reinterpret_cast<const InputType *>(lines[y]);
+			__m256d YMMField[] = { _mm256_load_pd(&Field.lanes[0]), _mm256_load_pd(&Field.lanes[4]) };
+			for (auto x = 0; x < p.WidthMod8; x += 8) {
+				__m256d YMMLine[2];
+				ToDouble(Linearize(LoadVector(p, &srcp[x]), p.transfer), YMMLine);
+				for (auto i = 0; i < 2; ++i)
+					YMMField[i] = _mm256_add_pd(YMMField[i], YMMLine[i]);
+			}
+			_mm256_store_pd(&Field.lanes[0], YMMField[0]);
+			_mm256_store_pd(&Field.lanes[4], YMMField[1]);
+			for (auto x = p.WidthMod8; x < p.width; ++x)
+				Field.lanes[x % 8] += ToLinear(LoadSample(p, srcp[x]), p.transfer);
+		}
+		FieldSum += GetFieldSum(p, Field, LineCount);
+	}
+
+	template<typename InputType>
+	auto Moments(const PlanePlan &p, const void *const *lines, FieldMoments &m) {
+		auto &&YMMCurrentBaseColor = _mm256_set1_pd(p.BaseColor);
+		ReductionLanes Lanes[5];
+		auto &&TopField = Lanes[0], &&BottomField = Lanes[1], &&TopSquare = Lanes[2], &&BottomSquare = Lanes[3], &&Cross = Lanes[4];
+		auto Line = [&](auto y) {
+			return reinterpret_cast<const InputType *>(lines[y]);
+		};
+		auto CalculateLinePair = [&](auto y) {
+			auto TopLine = Line(y), BottomLine = Line(y + 1);
+			__m256d YMMLanes[5][2];
+			for (auto i = 0; i < 5; ++i)
+				for (auto j = 0; j < 2; ++j)
+					YMMLanes[i][j] = _mm256_load_pd(&Lanes[i].lanes[j * 4]);
+			for (auto x = 0; x < p.WidthMod8; x += 8) {
+				__m256d YMMTop[2], YMMBottom[2];
+				ToDouble(Linearize(LoadVector(p, &TopLine[x]), p.transfer), YMMTop);
+				ToDouble(Linearize(LoadVector(p, &BottomLine[x]), p.transfer), YMMBottom);
+				for (auto i = 0; i < 2; ++i) {
+					YMMTop[i] = _mm256_sub_pd(YMMTop[i], YMMCurrentBaseColor);
+					YMMBottom[i] = _mm256_sub_pd(YMMBottom[i], YMMCurrentBaseColor);
+					YMMLanes[0][i] = _mm256_add_pd(YMMLanes[0][i], YMMTop[i]);
+					YMMLanes[1][i] = _mm256_add_pd(YMMLanes[1][i], YMMBottom[i]);
+					YMMLanes[2][i] = _mm256_add_pd(YMMLanes[2][i], _mm256_mul_pd(YMMTop[i], YMMTop[i]));
+					YMMLanes[3][i] = _mm256_add_pd(YMMLanes[3][i], _mm256_mul_pd(YMMBottom[i], YMMBottom[i]));
+					YMMLanes[4][i] = _mm256_add_pd(YMMLanes[4][i], _mm256_mul_pd(YMMTop[i], YMMBottom[i]));
 				}
-			};
-			auto FixFadesPrepare = [&]() {
-				auto &&YMMTopField = _mm256_setzero_ps();
-				auto &&YMMBottomField = _mm256_setzero_ps();
-				auto CalculateLine = [&](auto y, auto &FieldSum, auto &YMMField) {
-					for (auto x = WidthMod8; x < width; ++x)
-						FieldSum += srcp[y][x];
-					for (auto x = 0; x < WidthMod8; x += 8)
-						YMMField = _mm256_add_ps(reinterpret_cast<const __m256 &>(srcp[y][x]), YMMField);
-				};
-				auto YMMToFieldSum = [&]() {
-					auto Offset = CurrentBaseColor * FieldPixelCount;
-					for (auto i = 0; i < 8; ++i) {
-						TopFieldSum += reinterpret_cast<float *>(&YMMTopField)[i];
-						BottomFieldSum += reinterpret_cast<float *>(&YMMBottomField)[i];
-					}
-					TopFieldSum -= Offset;
-					BottomFieldSum -= Offset;
-				};
-				for (auto y = 0; y < height; ++y)
-					if (y % 2 == false)
-						CalculateLine(y, TopFieldSum, YMMTopField);
-					else
-						CalculateLine(y, BottomFieldSum, YMMBottomField);
-				YMMToFieldSum();
-			};
-			auto FixFadesMode0 = [&]() {
-				auto MeanSum = (TopFieldSum + BottomFieldSum) / 2.;
-				for (auto y = 0; y < height; ++y)
-					if (y % 2 == false)
-						ProcessLine(y, TopFieldSum, MeanSum);
-					else
-						ProcessLine(y, BottomFieldSum, MeanSum);
-			};
-			auto FixFadesMode1 = [&]() {
-				auto MinSum = std::min(TopFieldSum, BottomFieldSum);
-				if (MinSum == TopFieldSum)
-					for (auto y = 1; y < height; y += 2) {
-						ProcessLine(y, BottomFieldSum, MinSum);
-						CopyLine(y - 1);
-					}
-				else
-					for (auto y = 0; y < height; y += 2) {
-						ProcessLine(y, TopFieldSum, MinSum);
-						CopyLine(y + 1);
-					}
-			};
-			auto FixFadesMode2 = [&]() {
-				auto MaxSum = std::max(TopFieldSum, BottomFieldSum);
-				if (MaxSum == TopFieldSum)
-					for (auto y = 1; y < height; y += 2) {
-						ProcessLine(y, BottomFieldSum, MaxSum);
-						CopyLine(y - 1);
-					}
-				else
-					for (auto y = 0; y < height; y += 2) {
-						ProcessLine(y, TopFieldSum, MaxSum);
-						CopyLine(y + 1);
-					}
-			};
-			Initialize();
-			FixFadesPrepare();
-			if (GetNormalizedDifference() < d->threshold)
-				CopyToDestinationFrame();
+			}
+			for (auto i = 0; i < 5; ++i)
+				for (auto j = 0; j < 2; ++j)
+					_mm256_store_pd(&Lanes[i].lanes[j * 4], YMMLanes[i][j]);
+			for (auto x = p.WidthMod8; x < p.width; ++x) {
+				auto Top = ToLinear(LoadSample(p, TopLine[x]), p.transfer) - p.BaseColor;
+				auto Bottom = ToLinear(LoadSample(p, BottomLine[x]), p.transfer) - p.BaseColor;
+				TopField.lanes[x % 8] += Top;
+				BottomField.lanes[x % 8] += Bottom;
+				TopSquare.lanes[x % 8] += Top * Top;
+				BottomSquare.lanes[x % 8] += Bottom * Bottom;
+				Cross.lanes[x % 8] += Top * Bottom;
+			}
+		};
+		auto CalculateUnpairedLine = [&](auto y) {
+			auto TopLine = Line(y);
+			__m256d YMMField[] = { _mm256_load_pd(&TopField.lanes[0]), _mm256_load_pd(&TopField.lanes[4]) };
+			for (auto x = 0; x < p.WidthMod8; x += 8) {
+				__m256d YMMTop[2];
+				ToDouble(Linearize(LoadVector(p, &TopLine[x]), p.transfer), YMMTop);
+				for (auto i = 0; i < 2; ++i)
+					YMMField[i] = _mm256_add_pd(YMMField[i], _mm256_sub_pd(YMMTop[i], YMMCurrentBaseColor));
+			}
+			_mm256_store_pd(&TopField.lanes[0], YMMField[0]);
+			_mm256_store_pd(&TopField.lanes[4], YMMField[1]);
+			for (auto x = p.WidthMod8; x < p.width; ++x)
+				TopField.lanes[x % 8] += ToLinear(LoadSample(p, TopLine[x]), p.transfer) - p.BaseColor;
+		};
+		for (auto y = 0; y < p.height; y += 2)
+			if (y + 1 < p.height)
+				CalculateLinePair(y);
 			else
-				switch (d->mode) {
-				case 0:
-					FixFadesMode0();
-					break;
-				case 1:
-					FixFadesMode1();
-					break;
-				case 2:
-					FixFadesMode2();
-					break;
-				default:
-					break;
-				}
+				CalculateUnpairedLine(y);
+		m.TopFieldSum += Reduce(TopField);
+		m.BottomFieldSum += Reduce(BottomField);
+		m.TopSquareSum += Reduce(TopSquare);
+		m.BottomSquareSum += Reduce(BottomSquare);
+		m.CrossSum += Reduce(Cross);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ConvertLine(const PlanePlan &p, const void *source, void *destination, int y) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		if (!p.ConvertSamples)
+			std::memcpy(dstp, srcp, p.width * sizeof(InputType));
+		else {
+			for (auto x = 0; x < p.WidthMod8; x += 8)
+				StoreVector(p, &dstp[x], y, LoadVector(p, &srcp[x]));
+			for (auto x = p.WidthMod8; x < p.width; ++x)
+				StoreSample(p, LoadSample(p, srcp[x]), x, y, dstp[x]);
 		}
-		vsapi->freeFrame(src);
-		return dst;
 	}
-	return nullptr;
+
+	auto Apply(const PlanePlan &p, __m256 YMMLinear, __m256 YMMGain, __m256 YMMCurrentBaseColor) {
+		auto &&YMM0 = _mm256_sub_ps(YMMLinear, YMMCurrentBaseColor);
+		return Delinearize(_mm256_add_ps(_mm256_mul_ps(YMM0, YMMGain), YMMCurrentBaseColor), p.transfer);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessLine(const PlanePlan &p, const void *source, void *destination, int y, double Gain) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		auto &&YMMCurrentBaseColor = _mm256_set1_ps(static_cast<float>(p.BaseColor));
+		auto &&YMMGain = _mm256_set1_ps(SingleGain);
+		for (auto x = p.WidthMod8; x < p.width; ++x)
+			StoreSample(p, ApplyGain(p, LoadSample(p, srcp[x]), SingleGain), x, y, dstp[x]);
+		for (auto x = 0; x < p.WidthMod8; x += 8)
+			StoreVector(p, &dstp[x], y, Apply(p, Linearize(LoadVector(p, &srcp[x]), p.transfer), YMMGain, YMMCurrentBaseColor));
+	}
+
+	template<typename InputType, typename OperationType>
+	auto SumLine(const PlanePlan &p, const InputType *srcp, ReductionLanes &Field, OperationType &&Operation) {
+		__m256d YMMField[] = { _mm256_load_pd(&Field.lanes[0]), _mm256_load_pd(&Field.lanes[4]) };
+		for (auto x = 0; x < p.WidthMod8; x += 8) {
+			auto &&YMMSource = LoadVector(p, &srcp[x]);
+			auto &&YMMLinear = Linearize(YMMSource, p.transfer);
+			__m256d YMMLine[2];
+			ToDouble(YMMLinear, YMMLine);
+			for (auto i = 0; i < 2; ++i)
+				YMMField[i] = _mm256_add_pd(YMMField[i], YMMLine[i]);
+			Operation(x, YMMSource, YMMLinear);
+		}
+		_mm256_store_pd(&Field.lanes[0], YMMField[0]);
+		_mm256_store_pd(&Field.lanes[4], YMMField[1]);
+		for (auto x = p.WidthMod8; x < p.width; ++x)
+			Field.lanes[x % 8] += ToLinear(LoadSample(p, srcp[x]), p.transfer);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto CopySumLine(const PlanePlan &p, const void *source, void *destination, int y, ReductionLanes &Field) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		if (dstp == nullptr)
+			SumLine(p, srcp, Field, [](auto, auto, auto) {});
+		else if (!p.ConvertSamples) {
+			SumLine(p, srcp, Field, [&](auto x, auto, auto) {
+				std::memcpy(&dstp[x], &srcp[x], 8 * sizeof(InputType));
+			});
+			std::memcpy(&dstp[p.WidthMod8], &srcp[p.WidthMod8], (p.width - p.WidthMod8) * sizeof(InputType));
+		}
+		else {
+			SumLine(p, srcp, Field, [&](auto x, auto YMMSource, auto) {
+				StoreVector(p, &dstp[x], y, YMMSource);
+			});
+			for (auto x = p.WidthMod8; x < p.width; ++x)
+				StoreSample(p, LoadSample(p, srcp[x]), x, y, dstp[x]);
+		}
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessSumLine(const PlanePlan &p, const void *source, void *destination, int y, double Gain, ReductionLanes &Field) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		auto &&YMMCurrentBaseColor = _mm256_set1_ps(static_cast<float>(p.BaseColor));
+		auto &&YMMGain = _mm256_set1_ps(SingleGain);
+		SumLine(p, srcp, Field, [&](auto x, auto, auto YMMLinear) {
+			StoreVector(p, &dstp[x], y, Apply(p, YMMLinear, YMMGain, YMMCurrentBaseColor));
+		});
+		for (auto x = p.WidthMod8; x < p.width; ++x)
+			StoreSample(p, ApplyGain(p, LoadSample(p, srcp[x]), SingleGain), x, y, dstp[x]);
+	}
+
+	template<typename InputType, typename OutputType>
+	auto ProcessReferenceLine(const PlanePlan &p, const void *source, const void *reference, void *destination, int y, double Gain) {
+		auto srcp = reinterpret_cast<const InputType *>(source);
+		auto refp = reinterpret_cast<const InputType *>(reference);
+		auto dstp = reinterpret_cast<OutputType *>(destination);
+		auto SingleGain = static_cast<float>(Gain);
+		auto &&YMMGain = _mm256_set1_ps(SingleGain);
+		for (auto x = 0; x < p.WidthMod8; x += 8) {
+			auto &&YMMReference = Linearize(LoadVector(p, &refp[x]), p.transfer);
+			StoreVector(p, &dstp[x], y, Apply(p, Linearize(LoadVector(p, &srcp[x]), p.transfer), YMMGain, YMMReference));
+		}
+		for (auto x = p.WidthMod8; x < p.width; ++x)
+			StoreSample(p, ApplyGain(p, LoadSample(p, srcp[x]), SingleGain, ToLinear(LoadSample(p, refp[x]), p.transfer)), x, y, dstp[x]);
+	}
+
+	template<typename InputType, typename OutputType>
+	constexpr auto MakeKernels() {
+		return FixFadesKernels{ SumField<InputType>, Moments<InputType>, ConvertLine<InputType, OutputType>, ProcessLine<InputType, OutputType>,
+			CopySumLine<InputType, OutputType>, ProcessSumLine<InputType, OutputType>, ProcessReferenceLine<InputType, OutputType> };
+	}
 }
+
+extern const FixFadesKernels KernelsAVXFMA[3][3] = {
+	{ MakeKernels<uint8_t, uint8_t>(), MakeKernels<uint8_t, uint16_t>(), MakeKernels<uint8_t, float>() },
+	{ MakeKernels<uint16_t, uint8_t>(), MakeKernels<uint16_t, uint16_t>(), MakeKernels<uint16_t, float>() },
+	{ MakeKernels<float, uint8_t>(), MakeKernels<float, uint16_t>(), MakeKernels<float, float>() }
+};
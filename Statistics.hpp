@@ -0,0 +1,311 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cctype>
+
+// fixed point, so merging is exact and order independent
+namespace StatisticsLayout {
+	constexpr auto FixedPointScale = 4294967296.;
+	constexpr auto DifferenceLimit = 16.;
+	// 10 bins per decade from 1e-6, bin 0 holds everything below
+	constexpr auto HistogramBins = 64;
+	constexpr auto BinsPerDecade = 10;
+	constexpr auto HistogramFloor = -6;
+	// planes seen before the noise floor is estimated
+	constexpr auto NoiseFloorWarmup = 16;
+
+	template<typename CounterType>
+	struct Counters {
+		struct PlaneCounters final {
+			CounterType FrameCount{};
+			CounterType CorrectedCount{};
+			CounterType DifferenceSum{};
+			CounterType DifferenceSquareSum{};
+			CounterType DifferenceMax{};
+			CounterType histogram[HistogramBins]{};
+		};
+		PlaneCounters planes[3];
+		CounterType ModeFrames[3][2]{};
+		CounterType PredictionAccepted{};
+		CounterType PredictionRejected{};
+		CounterType BytesRead{};
+		CounterType BytesWritten{};
+	};
+
+	// calls Visit(a, b, IsMaximum) on every pair of matching counters
+	template<typename FirstType, typename SecondType, typename VisitorType>
+	auto VisitCounters(FirstType &a, SecondType &b, VisitorType &&Visit) {
+		for (auto i = 0; i < 3; ++i) {
+			auto &&x = a.planes[i];
+			auto &&y = b.planes[i];
+			Visit(x.FrameCount, y.FrameCount, false);
+			Visit(x.CorrectedCount, y.CorrectedCount, false);
+			Visit(x.DifferenceSum, y.DifferenceSum, false);
+			Visit(x.DifferenceSquareSum, y.DifferenceSquareSum, false);
+			Visit(x.DifferenceMax, y.DifferenceMax, true);
+			for (auto j = 0; j < HistogramBins; ++j)
+				Visit(x.histogram[j], y.histogram[j], false);
+		}
+		for (auto i = 0; i < 3; ++i)
+			for (auto j = 0; j < 2; ++j)
+				Visit(a.ModeFrames[i][j], b.ModeFrames[i][j], false);
+		Visit(a.PredictionAccepted, b.PredictionAccepted, false);
+		Visit(a.PredictionRejected, b.PredictionRejected, false);
+		Visit(a.BytesRead, b.BytesRead, false);
+		Visit(a.BytesWritten, b.BytesWritten, false);
+	}
+
+	static inline auto GetBinLowerEdge(int bin) {
+		return bin == 0 ? 0. : std::pow(10., HistogramFloor + static_cast<double>(bin - 1) / BinsPerDecade);
+	}
+
+	static inline auto GetBin(double NormalizedDifference) {
+		if (!(NormalizedDifference >= GetBinLowerEdge(1)))
+			return 0;
+		auto bin = static_cast<int>(std::floor((std::log10(NormalizedDifference) - HistogramFloor) * BinsPerDecade)) + 1;
+		return std::min(std::max(bin, 1), HistogramBins - 1);
+	}
+}
+
+struct StatisticsTotals final : StatisticsLayout::Counters<int64_t> {
+	static constexpr auto Version = 2;
+	auto Merge(const StatisticsTotals &other) {
+		StatisticsLayout::VisitCounters(*this, other, [](auto &x, auto y, auto IsMaximum) {
+			x = IsMaximum ? std::max(x, y) : x + y;
+		});
+	}
+	auto GetMeanDifference(int plane) const {
+		auto &&p = planes[plane];
+		return p.FrameCount == 0 ? 0. : p.DifferenceSum / StatisticsLayout::FixedPointScale / p.FrameCount;
+	}
+	auto Serialize() const {
+		auto stream = std::ostringstream{};
+		stream << "fixfades-statistics " << Version << "\n";
+		for (auto i = 0; i < 3; ++i) {
+			auto &&p = planes[i];
+			stream << "plane " << i
+				<< " frames " << p.FrameCount
+				<< " corrected " << p.CorrectedCount
+				<< " difference_sum " << p.DifferenceSum
+				<< " difference_square_sum " << p.DifferenceSquareSum
+				<< " difference_max " << p.DifferenceMax << "\n";
+			stream << "histogram " << i;
+			for (auto &&x : p.histogram)
+				stream << " " << x;
+			stream << "\n";
+		}
+		for (auto i = 0; i < 3; ++i)
+			stream << "mode " << i << " passthrough " << ModeFrames[i][0] << " corrected " << ModeFrames[i][1] << "\n";
+		stream << "prediction accepted " << PredictionAccepted << " rejected " << PredictionRejected << "\n";
+		stream << "bytes read " << BytesRead << " written " << BytesWritten << "\n";
+		return stream.str();
+	}
+	auto Parse(std::istream &input) {
+		auto header = std::string{};
+		auto version = 0;
+		if (!(input >> header >> version) || header != "fixfades-statistics" || version != Version)
+			return false;
+		auto Expect = [&](const char *key, int64_t &value) {
+			auto tag = std::string{};
+			return static_cast<bool>(input >> tag >> value) && tag == key;
+		};
+		auto GetIndex = [&](int &index) {
+			return static_cast<bool>(input >> index) && index >= 0 && index < 3;
+		};
+		auto tag = std::string{};
+		while (input >> tag) {
+			auto index = 0;
+			auto valid = true;
+			if (tag == "plane")
+				valid = GetIndex(index) && Expect("frames", planes[index].FrameCount) && Expect("corrected", planes[index].CorrectedCount) &&
+					Expect("difference_sum", planes[index].DifferenceSum) && Expect("difference_square_sum", planes[index].DifferenceSquareSum) &&
+					Expect("difference_max", planes[index].DifferenceMax);
+			else if (tag == "histogram") {
+				valid = GetIndex(index);
+				for (auto i = 0; valid && i < StatisticsLayout::HistogramBins; ++i)
+					valid = static_cast<bool>(input >> planes[index].histogram[i]);
+			}
+			else if (tag == "mode")
+				valid = GetIndex(index) && Expect("passthrough", ModeFrames[index][0]) && Expect("corrected", ModeFrames[index][1]);
+			else if (tag == "prediction")
+				valid = Expect("accepted", PredictionAccepted) && Expect("rejected", PredictionRejected);
+			else if (tag == "bytes")
+				valid = Expect("read", BytesRead) && Expect("written", BytesWritten);
+			else
+				valid = false;
+			if (!valid)
+				return false;
+		}
+		return true;
+	}
+	// frames of a plane that a given threshold would correct, for every histogram bin edge
+	auto GetCorrectedAtThreshold(int plane, int bin) const {
+		auto count = 0ll;
+		for (auto i = bin; i < StatisticsLayout::HistogramBins; ++i)
+			count += planes[plane].histogram[i];
+		return count;
+	}
+	auto WriteJSON(std::ostream &output, double threshold, int64_t mode) const {
+		using namespace StatisticsLayout;
+		auto FrameCount = 0ll;
+		for (auto &&x : ModeFrames)
+			FrameCount += x[0] + x[1];
+		output << std::setprecision(9);
+		output << "{\n";
+		output << "  \"threshold\": " << threshold << ",\n";
+		output << "  \"mode\": " << mode << ",\n";
+		output << "  \"modes\": [";
+		for (auto i = 0; i < 3; ++i)
+			output << (i ? ", " : "") << "{ \"mode\": " << i << ", \"passthrough\": " << ModeFrames[i][0] << ", \"corrected\": " << ModeFrames[i][1] << " }";
+		output << "],\n";
+		output << "  \"prediction\": { \"accepted\": " << PredictionAccepted << ", \"rejected\": " << PredictionRejected << " },\n";
+		output << "  \"bytes\": { \"read\": " << BytesRead << ", \"written\": " << BytesWritten << ", \"per_frame\": " << (FrameCount == 0 ? 0. : static_cast<double>(BytesRead + BytesWritten) / FrameCount) << " },\n";
+		output << "  \"planes\": [\n";
+		for (auto i = 0; i < 3; ++i) {
+			auto &&p = planes[i];
+			output << "    {\n";
+			output << "      \"plane\": " << i << ",\n";
+			output << "      \"frames\": " << p.FrameCount << ",\n";
+			output << "      \"corrected\": " << p.CorrectedCount << ",\n";
+			output << "      \"mean_difference\": " << GetMeanDifference(i) << ",\n";
+			output << "      \"max_difference\": " << p.DifferenceMax / FixedPointScale << ",\n";
+			output << "      \"histogram\": [\n";
+			for (auto j = 0; j < HistogramBins; ++j) {
+				output << "        { \"lower\": " << GetBinLowerEdge(j) << ", \"upper\": ";
+				if (j + 1 < HistogramBins)
+					output << GetBinLowerEdge(j + 1);
+				else
+					output << "null";
+				output << ", \"frames\": " << p.histogram[j] << ", \"corrected_at_lower\": " << GetCorrectedAtThreshold(i, j) << " }" << (j + 1 < HistogramBins ? "," : "") << "\n";
+			}
+			output << "      ]\n";
+			output << "    }" << (i < 2 ? "," : "") << "\n";
+		}
+		output << "  ]\n";
+		output << "}\n";
+	}
+	auto WriteCSV(std::ostream &output, double threshold, int64_t mode) const {
+		using namespace StatisticsLayout;
+		output << std::setprecision(9);
+		output << "# threshold " << threshold << ", mode " << mode << "\n";
+		for (auto i = 0; i < 3; ++i)
+			output << "# mode " << i << ": passthrough " << ModeFrames[i][0] << ", corrected " << ModeFrames[i][1] << "\n";
+		output << "# prediction: accepted " << PredictionAccepted << ", rejected " << PredictionRejected << "\n";
+		output << "# bytes: read " << BytesRead << ", written " << BytesWritten << "\n";
+		output << "plane,lower,upper,frames,corrected_at_lower\n";
+		for (auto i = 0; i < 3; ++i)
+			for (auto j = 0; j < HistogramBins; ++j) {
+				output << i << "," << GetBinLowerEdge(j) << ",";
+				if (j + 1 < HistogramBins)
+					output << GetBinLowerEdge(j + 1);
+				output << "," << planes[i].histogram[j] << "," << GetCorrectedAtThreshold(i, j) << "\n";
+			}
+	}
+};
+
+struct ClipStatistics final {
+	// one shard per thread slot, padded since C++14 operator new ignores alignas(64)
+	static constexpr auto ShardCount = 16;
+	struct Shard final : StatisticsLayout::Counters<std::atomic<int64_t>> {
+		char padding[64];
+	};
+	Shard shards[ShardCount];
+	StatisticsTotals imported;
+	auto GetShard()->Shard & {
+		return shards[std::hash<std::thread::id>{}(std::this_thread::get_id()) % ShardCount];
+	}
+	static auto ToFixedPoint(double x) {
+		using namespace StatisticsLayout;
+		return static_cast<int64_t>(std::llround(std::min(std::max(x, 0.), DifferenceLimit) * FixedPointScale));
+	}
+	static auto Add(std::atomic<int64_t> &target, int64_t value) {
+		target.fetch_add(value, std::memory_order_relaxed);
+	}
+	static auto UpdateMax(std::atomic<int64_t> &target, int64_t value) {
+		auto current = target.load(std::memory_order_relaxed);
+		while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed));
+	}
+	auto RecordPlane(int plane, double NormalizedDifference, bool corrected) {
+		auto &&p = GetShard().planes[plane];
+		auto Difference = ToFixedPoint(NormalizedDifference);
+		Add(p.FrameCount, 1);
+		Add(p.CorrectedCount, corrected);
+		Add(p.DifferenceSum, Difference);
+		Add(p.DifferenceSquareSum, ToFixedPoint(NormalizedDifference * NormalizedDifference));
+		UpdateMax(p.DifferenceMax, Difference);
+		Add(p.histogram[StatisticsLayout::GetBin(NormalizedDifference)], 1);
+	}
+	auto RecordPrediction(bool accepted) {
+		Add(accepted ? GetShard().PredictionAccepted : GetShard().PredictionRejected, 1);
+	}
+	auto RecordFrame(int64_t mode, bool corrected, int64_t BytesRead, int64_t BytesWritten) {
+		auto &&s = GetShard();
+		Add(s.ModeFrames[mode][corrected], 1);
+		Add(s.BytesRead, BytesRead);
+		Add(s.BytesWritten, BytesWritten);
+	}
+	auto Collect() const {
+		auto totals = imported;
+		for (auto &&s : shards)
+			StatisticsLayout::VisitCounters(totals, s, [](auto &x, auto &y, auto IsMaximum) {
+				auto value = y.load(std::memory_order_relaxed);
+				x = IsMaximum ? std::max(x, value) : x + value;
+			});
+		return totals;
+	}
+	// upper edge of the bin holding the median normalized difference
+	auto EstimateNoiseFloor(int plane, bool ImportedOnly, double &NoiseFloor) const {
+		using namespace StatisticsLayout;
+		int64_t histogram[HistogramBins];
+		auto FrameCount = int64_t{ 0 };
+		for (auto i = 0; i < HistogramBins; ++i) {
+			histogram[i] = imported.planes[plane].histogram[i];
+			if (!ImportedOnly)
+				for (auto &&s : shards)
+					histogram[i] += s.planes[plane].histogram[i].load(std::memory_order_relaxed);
+			FrameCount += histogram[i];
+		}
+		if (FrameCount < NoiseFloorWarmup)
+			return false;
+		auto Cumulative = int64_t{ 0 };
+		for (auto i = 0; i < HistogramBins; ++i) {
+			Cumulative += histogram[i];
+			if (Cumulative * 2 >= FrameCount) {
+				NoiseFloor = GetBinLowerEdge(std::min(i + 1, HistogramBins - 1));
+				break;
+			}
+		}
+		return true;
+	}
+	auto Import(const std::string &path) {
+		auto input = std::ifstream{ path };
+		auto totals = StatisticsTotals{};
+		if (!input.is_open() || !totals.Parse(input))
+			return false;
+		imported.Merge(totals);
+		return true;
+	}
+	auto Export(const std::string &path) const {
+		auto output = std::ofstream{ path };
+		output << Collect().Serialize();
+		return static_cast<bool>(output);
+	}
+	auto Report(const std::string &path, double threshold, int64_t mode) const {
+		auto output = std::ofstream{ path };
+		auto extension = path.substr(std::min(path.rfind('.'), path.size()));
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](auto c) { return static_cast<char>(std::tolower(c)); });
+		if (extension == ".json")
+			Collect().WriteJSON(output, threshold, mode);
+		else
+			Collect().WriteCSV(output, threshold, mode);
+		return static_cast<bool>(output);
+	}
+};
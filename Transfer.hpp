@@ -0,0 +1,112 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// transfer characteristics, numbered as in ITU-T H.273 and the _Transfer frame property
+enum : int64_t {
+	TransferBT1886 = 1,
+	TransferLinear = 8,
+	TransferSRGB = 13,
+	TransferPQ = 16
+};
+
+// the AVX versions evaluate the same operations
+namespace TransferApproximation {
+	constexpr auto Sqrt2 = 1.41421356f;
+	constexpr float Log2Coefficients[] = { 2.88539008f, 0.961796694f, 0.577078016f, 0.412198583f, 0.320598898f };
+	constexpr float Exp2Coefficients[] = { 1.f, 0.693147181f, 0.240226507f, 0.0555041087f, 0.00961812911f, 0.00133335581f, 0.000154035304f, 0.0000152527338f };
+	constexpr auto SRGBLinearThreshold = 0.04045f;
+	constexpr auto SRGBEncodedThreshold = 0.0031308f;
+	constexpr auto SRGBSlope = 12.92f;
+	constexpr auto SRGBOffset = 0.055f;
+	constexpr auto SRGBScale = 1.055f;
+	constexpr auto SRGBGamma = 2.4f;
+	constexpr auto BT1886Gamma = 2.4f;
+	constexpr auto PQm1 = 0.1593017578125f;
+	constexpr auto PQm2 = 78.84375f;
+	constexpr auto PQc1 = 0.8359375f;
+	constexpr auto PQc2 = 18.8515625f;
+	constexpr auto PQc3 = 18.6875f;
+
+	// std::min and std::max, local to the translation unit
+	static inline auto Min(float a, float b) {
+		return b < a ? b : a;
+	}
+
+	static inline auto Max(float a, float b) {
+		return a < b ? b : a;
+	}
+
+	static inline auto Log2(float x) {
+		auto Bits = 0u;
+		std::memcpy(&Bits, &x, sizeof(Bits));
+		auto Exponent = static_cast<float>(static_cast<int32_t>(Bits >> 23) - 127);
+		Bits = (Bits & 0x007FFFFFu) | 0x3F800000u;
+		auto Mantissa = 0.f;
+		std::memcpy(&Mantissa, &Bits, sizeof(Bits));
+		if (Mantissa > Sqrt2) {
+			Mantissa *= 0.5f;
+			Exponent += 1.f;
+		}
+		auto t = (Mantissa - 1.f) / (Mantissa + 1.f);
+		auto t2 = t * t;
+		auto Polynomial = fmaf(t2, Log2Coefficients[4], Log2Coefficients[3]);
+		Polynomial = fmaf(Polynomial, t2, Log2Coefficients[2]);
+		Polynomial = fmaf(Polynomial, t2, Log2Coefficients[1]);
+		Polynomial = fmaf(Polynomial, t2, Log2Coefficients[0]);
+		return fmaf(Polynomial, t, Exponent);
+	}
+
+	static inline auto Exp2(float x) {
+		x = Min(Max(x, -126.f), 126.f);
+		auto Integer = nearbyintf(x);
+		auto Fraction = x - Integer;
+		auto Polynomial = Exp2Coefficients[7];
+		for (auto i = 6; i >= 0; --i)
+			Polynomial = fmaf(Polynomial, Fraction, Exp2Coefficients[i]);
+		auto Bits = static_cast<uint32_t>(static_cast<int32_t>(Integer) + 127) << 23;
+		auto Scale = 0.f;
+		std::memcpy(&Scale, &Bits, sizeof(Bits));
+		return Polynomial * Scale;
+	}
+
+	static inline auto Pow(float x, float Exponent) {
+		return x > 0.f ? Exp2(Exponent * Log2(x)) : 0.f;
+	}
+}
+
+static inline auto ToLinear(float x, int64_t Transfer) {
+	using namespace TransferApproximation;
+	auto Magnitude = fabsf(x);
+	switch (Transfer) {
+	case TransferBT1886:
+		return copysignf(Pow(Magnitude, BT1886Gamma), x);
+	case TransferSRGB:
+		return copysignf(Magnitude <= SRGBLinearThreshold ? Magnitude / SRGBSlope : Pow((Magnitude + SRGBOffset) / SRGBScale, SRGBGamma), x);
+	case TransferPQ: {
+		auto Encoded = Pow(Max(x, 0.f), 1.f / PQm2);
+		return Pow(Max(Encoded - PQc1, 0.f) / fmaf(-PQc3, Encoded, PQc2), 1.f / PQm1);
+	}
+	default:
+		return x;
+	}
+}
+
+static inline auto FromLinear(float x, int64_t Transfer) {
+	using namespace TransferApproximation;
+	auto Magnitude = fabsf(x);
+	switch (Transfer) {
+	case TransferBT1886:
+		return copysignf(Pow(Magnitude, 1.f / BT1886Gamma), x);
+	case TransferSRGB:
+		return copysignf(Magnitude <= SRGBEncodedThreshold ? Magnitude * SRGBSlope : fmaf(SRGBScale, Pow(Magnitude, 1.f / SRGBGamma), -SRGBOffset), x);
+	case TransferPQ: {
+		auto Linear = Pow(Max(x, 0.f), PQm1);
+		return Pow(fmaf(PQc2, Linear, PQc1) / fmaf(PQc3, Linear, 1.f), PQm2);
+	}
+	default:
+		return x;
+	}
+}